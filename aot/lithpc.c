@@ -0,0 +1,225 @@
+/*
+ * lithpc.c
+ * --------
+ *
+ *   Builds standalone binaries of lithp programs. `lithpc prog` reads
+ *   prog.th, together with every file it imports at the top level by a
+ *   literal name, writes the forms as C data to prog.c and has the C
+ *   compiler link that with the runtime into ./prog.
+ *
+ *   This embeds the source, it doesn't translate lisp to C: the program
+ *   skips finding, reading and parsing its files, then evaluates the
+ *   same forms with the same bytecode VM and JIT as `./lithp prog`.
+ *   Imports are looked up relative to where lithpc is run, like lithp
+ *   does; those that can't be read are left for the program to try.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+
+#include "lithp.h"
+
+
+#define LITHPC_MAX_IMPORTS 64 /* nested, guards against cycles */
+
+
+static int
+is_import(lval *x)
+{
+    return LVAL_TYPE(x) == LVAL_SEXPR && x->count == 2 &&
+           LVAL_TYPE(x->cell[0]) == LVAL_SYM &&
+           strcmp(x->cell[0]->symbol, "import") == 0 &&
+           LVAL_TYPE(x->cell[1]) == LVAL_STR;
+}
+
+
+/*
+ * Function:  read_file
+ * --------------------
+ *   Add the forms of *name*.th to *forms*, those of the files it imports
+ *   in their place. Return 0 if it can't be read, printing why if
+ *   *report* is set.
+ */
+static int
+read_file(char *name, lval **forms, int depth, int report)
+{
+    char *filename = malloc(strlen(name) + 4);
+    sprintf(filename, "%s.th", name);
+
+    mpc_result_t r;
+    int ok = mpc_parse_contents(filename, Program, &r);
+    free(filename);
+    if (!ok) {
+        if (report)
+            mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return 0;
+    }
+
+    lval *expr = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    while (expr->count) {
+        lval *x = lval_pop(expr, 0);
+        if (is_import(x) && depth < LITHPC_MAX_IMPORTS &&
+            read_file(x->cell[1]->str, forms, depth + 1, 0)) {
+            lval_cleanup(x);
+            continue;
+        }
+        *forms = lval_add(*forms, x);
+    }
+    lval_cleanup(expr);
+    return 1;
+}
+
+
+static void
+write_string(FILE *out, char *s)
+{
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(out, "\\%c", c);
+        else if (c < ' ' || c > '~')
+            fprintf(out, "\\%03o", c);
+        else
+            fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+
+static void
+write_node(FILE *out, lval *x)
+{
+    switch (LVAL_TYPE(x)) {
+    case LVAL_NUM:
+        if (LVAL_NUMBER(x) == INTMAX_MIN)
+            fputs("    {.type = LNODE_NUM, .num = INTMAX_MIN},\n", out);
+        else
+            fprintf(
+                out, "    {.type = LNODE_NUM, .num = %jd},\n", LVAL_NUMBER(x));
+        return;
+
+    case LVAL_FLOAT: /* in hex, to be exact */
+        fprintf(out, "    {.type = LNODE_FLOAT, .fnum = %a},\n", x->fnumber);
+        return;
+
+    case LVAL_BIG: {
+        char *digits = lbig_to_str(x);
+        fprintf(out, "    {.type = LNODE_BIG, .str = \"%s\"},\n", digits);
+        free(digits);
+        return;
+    }
+
+    case LVAL_SYM:
+    case LVAL_STR:
+    case LVAL_ERR:
+        fprintf(
+            out, "    {.type = %s, .str = ",
+            LVAL_TYPE(x) == LVAL_SYM   ? "LNODE_SYM"
+            : LVAL_TYPE(x) == LVAL_STR ? "LNODE_STR"
+                                       : "LNODE_ERR");
+        write_string(
+            out, LVAL_TYPE(x) == LVAL_SYM   ? x->symbol
+                 : LVAL_TYPE(x) == LVAL_STR ? x->str
+                                            : x->error_msg);
+        fputs("},\n", out);
+        return;
+
+    default:
+        fprintf(
+            out, "    {.type = %s, .num = %lu},\n",
+            LVAL_TYPE(x) == LVAL_SEXPR   ? "LNODE_SEXPR"
+            : LVAL_TYPE(x) == LVAL_QEXPR ? "LNODE_QEXPR"
+                                         : "LNODE_VEC",
+            x->count);
+        for (uint64_t i = 0; i < x->count; i++)
+            write_node(out, x->cell[i]);
+        return;
+    }
+}
+
+
+static int
+write_program(char *filename, char *source, lval *forms)
+{
+    FILE *out = fopen(filename, "w");
+    if (!out) {
+        perror(filename);
+        return 0;
+    }
+
+    fprintf(out, "/* %s.th parsed by lithpc */\n\n\n", source);
+    fputs("#include \"lithpc.h\"\n\n\n", out);
+    fputs("static const lnode program[] = {\n", out);
+    for (uint64_t i = 0; i < forms->count; i++)
+        write_node(out, forms->cell[i]);
+    fputs("    {.type = LNODE_END},\n};\n\n\n", out);
+    fputs("int\nmain(void)\n{\n    return lithpc_run(program);\n}\n", out);
+
+    return fclose(out) == 0;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char *name = NULL;
+    char *output = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+            output = argv[++i];
+        else
+            name = argv[i];
+    }
+    if (!name) {
+        fputs("usage: lithpc file [-o output]\n", stderr);
+        return 1;
+    }
+
+    /* like lithp, take the name with or without .th */
+    size_t len = strlen(name);
+    if (len > 3 && strcmp(name + len - 3, ".th") == 0)
+        name[len - 3] = '\0';
+    if (!output)
+        output = name;
+
+    lread_init();
+    lval *forms = lval_qexpr();
+    if (!read_file(name, &forms, 0, 1))
+        return 1;
+
+    char *filename = malloc(strlen(output) + 3);
+    sprintf(filename, "%s.c", output);
+    int ok = write_program(filename, name, forms);
+    lval_cleanup(forms);
+    lread_cleanup();
+    if (!ok) {
+        free(filename);
+        return 1;
+    }
+
+    const char *fmt = "%s %s -I '%s/src' -I '%s/include' -I '%s/aot' '%s' "
+                      "'%s/liblithp.a' -lm -o '%s'";
+    size_t size = snprintf(
+                      NULL, 0, fmt, LITHPC_CC, LITHPC_CFLAGS, LITHPC_DIR,
+                      LITHPC_DIR, LITHPC_DIR, filename, LITHPC_DIR, output) +
+                  1;
+    char *command = malloc(size);
+    snprintf(
+        command, size, fmt, LITHPC_CC, LITHPC_CFLAGS, LITHPC_DIR, LITHPC_DIR,
+        LITHPC_DIR, filename, LITHPC_DIR, output);
+
+    int status = system(command);
+    free(command);
+    free(filename);
+    return status == 0 ? 0 : 1;
+}
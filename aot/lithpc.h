@@ -0,0 +1,37 @@
+/*
+ * lithpc.h
+ * --------
+ *
+ *   What programs written by lithpc are made of: the forms of the
+ *   program as a flat array of nodes, every s- or q-expression followed
+ *   by its `count` cells, ending with `LNODE_END`.
+ *
+ */
+
+
+#include <stdint.h>
+
+
+typedef enum {
+    LNODE_END,
+    LNODE_NUM,
+    LNODE_FLOAT,
+    LNODE_BIG, /* in decimal in `str` */
+    LNODE_SYM,
+    LNODE_STR,
+    LNODE_ERR,
+    LNODE_SEXPR,
+    LNODE_QEXPR,
+    LNODE_VEC,
+} lnode_type;
+
+typedef struct {
+    lnode_type type;
+    intmax_t num; /* the number, or the count of an expression */
+    const char *str;
+    double fnum;
+} lnode;
+
+
+int
+lithpc_run(const lnode *program);
@@ -0,0 +1,76 @@
+/*
+ * runtime.c
+ * ---------
+ *
+ *   Entry point of programs built by lithpc, see lithpc.c.
+ *
+ */
+
+
+#include <stdint.h>
+
+#include "lithp.h"
+#include "lithpc.h"
+
+
+static lval *
+build(const lnode **n)
+{
+    const lnode *x = (*n)++;
+    lval *v;
+
+    switch (x->type) {
+    case LNODE_NUM:
+        return lval_num(x->num);
+    case LNODE_FLOAT:
+        return lval_float(x->fnum);
+    case LNODE_BIG:
+        return lbig_read((char *)x->str);
+    case LNODE_SYM:
+        return lval_sym((char *)x->str);
+    case LNODE_STR:
+        return lval_str((char *)x->str);
+    case LNODE_ERR:
+        return lval_err("%s", x->str);
+    case LNODE_SEXPR:
+        v = lval_sexpr();
+        break;
+    case LNODE_QEXPR:
+        v = lval_qexpr();
+        break;
+    default:
+        v = lval_vec();
+        break;
+    }
+
+    for (intmax_t i = 0; i < x->num; i++)
+        v = lval_add(v, build(n));
+    return v;
+}
+
+
+/*
+ * Function:  lithpc_run
+ * ---------------------
+ *   Evaluate the forms of *program* one after the other, the way `lithp`
+ *   does with the file it's given.
+ */
+int
+lithpc_run(const lnode *program)
+{
+    lread_init();
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    while (program->type != LNODE_END) {
+        lval *x = lval_eval(e, build(&program));
+        if (LVAL_TYPE(x) == LVAL_ERR)
+            lval_println(x);
+        lval_cleanup(x);
+        gc_maybe_collect(e);
+    }
+
+    lenv_clean_up(e);
+    lread_cleanup();
+    return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/bash
+# Time calls to a function defined after N other globals. Parsing the
+# definitions takes a while by itself, compare with `bench/globals.sh 0`.
+#
+#   $ bench/globals.sh 10000
+
+n=${1:-1000}
+file=$(mktemp -d)/globals
+
+{
+    echo "(import 'stdlib')"
+    i=0
+    while [ $i -lt "$n" ]; do
+        echo "(def {global$i} $i)"
+        i=$((i + 1))
+    done
+    echo "(fun {count n} {if (== n 0) {0} {count (- n 1)}})"
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        echo "(print (count 2000))"
+    done
+} > "$file.th"
+
+time ./lithp "$file"
+rm -r "$(dirname "$file")"
@@ -0,0 +1,419 @@
+/*
+ * alloc.c
+ * -------
+ *
+ *   Size-class slab allocator for `lval`s, environments and cell
+ *   arrays. These are small, short lived and freed with a known size,
+ *   so each size class keeps its own free list and carves new chunks out
+ *   of big slabs instead of asking libc every time.
+ *
+ *   Free lists are thread local. Everything bigger than `SLAB_MAX_SIZE`
+ *   goes straight to malloc. Build with `-DLITHP_MALLOC` (`make
+ *   ALLOCATOR=malloc`) to use libc for everything, e.g. to compare or
+ *   to run under a memory checker.
+ *
+ *   Memory that can't outlive a builtin call is bumped out of a region
+ *   instead, see `lregion_alloc`.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lithp.h"
+
+
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_MAX_SIZE 1024
+#define SLAB_CLASSES 12 /* 8, 16, ..., 64, 128, 256, 512, 1024 */
+#define REGION_SIZE (16 * 1024)
+
+
+typedef struct lchunk lchunk;
+struct lchunk {
+    lchunk *next;
+};
+
+
+typedef struct {
+    lchunk *free; /* chunks handed back by `lfree` */
+    char *bump;   /* uncarved part of the newest slab */
+    char *end;
+} lpool;
+
+
+static _Thread_local lalloc_stats stats;
+
+static _Thread_local _Alignas(16) char region[REGION_SIZE];
+static _Thread_local size_t region_used;
+
+
+static int
+in_region(void *p)
+{
+    return (uintptr_t)p - (uintptr_t)region < REGION_SIZE;
+}
+
+
+#ifndef LITHP_MALLOC
+static _Thread_local lpool pools[SLAB_CLASSES];
+
+
+/*
+ * Function:  size_class
+ * ---------------------
+ *   Return the pool index for an allocation of *size* bytes, or -1 if
+ *   it is too big for the slabs.
+ */
+static int
+size_class(size_t size)
+{
+    if (size <= 64)
+        return (size + 7) / 8 - 1;
+    if (size > SLAB_MAX_SIZE)
+        return -1;
+
+    int class = 8;
+    for (size_t s = 128; s < size; s <<= 1)
+        class++;
+    return class;
+}
+
+
+static size_t
+class_size(int class)
+{
+    if (class < 8)
+        return (class + 1) * 8;
+    return (size_t)128 << (class - 8);
+}
+#endif
+
+
+void *
+lalloc(size_t size)
+{
+    if (size == 0)
+        return NULL;
+
+    stats.allocs++;
+
+#ifndef LITHP_MALLOC
+    int class = size_class(size);
+    if (class >= 0) {
+        lpool *pool = &pools[class];
+        if (pool->free) {
+            stats.hits++;
+            lchunk *c = pool->free;
+            pool->free = c->next;
+            return c;
+        }
+
+        size_t csize = class_size(class);
+        if (pool->bump + csize > pool->end) {
+            /* the tail of the old slab is too small to be worth keeping */
+            pool->bump = malloc(SLAB_SIZE);
+            pool->end = pool->bump + SLAB_SIZE;
+            stats.slabs++;
+        }
+        void *p = pool->bump;
+        pool->bump += csize;
+        return p;
+    }
+#endif
+
+    stats.large++;
+    return malloc(size);
+}
+
+
+void
+lfree(void *p, size_t size)
+{
+    if (!p || in_region(p))
+        return;
+
+    stats.frees++;
+
+#ifndef LITHP_MALLOC
+    int class = size_class(size);
+    if (class >= 0) {
+        lchunk *c = p;
+        c->next = pools[class].free;
+        pools[class].free = c;
+        return;
+    }
+#endif
+
+    (void)size;
+    free(p);
+}
+
+
+/*
+ * Function:  lrealloc
+ * -------------------
+ *   Resize *p* from *old* to *new* bytes. Stays in place when both sizes
+ *   fall in the same class.
+ */
+void *
+lrealloc(void *p, size_t old, size_t new)
+{
+    if (!p)
+        return lalloc(new);
+    if (new == 0) {
+        lfree(p, old);
+        return NULL;
+    }
+    if (in_region(p)) {
+        void *n = lalloc(new);
+        memcpy(n, p, old < new ? old : new);
+        return n;
+    }
+
+#ifndef LITHP_MALLOC
+    int class = size_class(old);
+    if (class >= 0 && class == size_class(new))
+        return p;
+    if (class < 0 && size_class(new) < 0)
+        return realloc(p, new);
+
+    void *n = lalloc(new);
+    memcpy(n, p, old < new ? old : new);
+    lfree(p, old);
+    return n;
+#else
+    (void)old;
+    return realloc(p, new);
+#endif
+}
+
+
+lalloc_stats
+lalloc_get_stats(void)
+{
+    return stats;
+}
+
+
+/*****************************************************************************/
+/*                                   REGION                                  */
+/*****************************************************************************/
+
+/*
+ * Function:  lregion_alloc
+ * ------------------------
+ *   Return *size* bytes from the region, or NULL if it is full. Freeing
+ *   them, with `lfree` or `lheap_free`, does nothing; they are taken back
+ *   by `lregion_reset` to a mark from before they were allocated.
+ */
+void *
+lregion_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (size > REGION_SIZE - region_used)
+        return NULL;
+
+    stats.region++;
+    void *p = region + region_used;
+    region_used += size;
+    return p;
+}
+
+
+size_t
+lregion_mark(void)
+{
+    return region_used;
+}
+
+
+void
+lregion_reset(size_t mark)
+{
+    region_used = mark;
+}
+
+
+/*****************************************************************************/
+/*                                OBJECT HEAPS                               */
+/*****************************************************************************/
+
+/* `lval`s and `lenv`s get slabs of their own. Those are aligned to their
+ * size, so the slab of an object is found by masking its address, and
+ * keep a bitmap of the chunks in use plus one for the garbage collector
+ * to mark in. That way gc.c can walk every object on the heap. */
+
+#define SLAB_CHUNKS (SLAB_SIZE / 16) /* most chunks a slab can hold */
+
+
+typedef struct lslab lslab;
+struct lslab {
+    lslab *next;
+    size_t csize;
+    uint32_t chunks; /* chunks that fit in `data` */
+    uint32_t carved; /* chunks handed out at least once */
+    uint64_t live[SLAB_CHUNKS / 64];
+    uint64_t mark[SLAB_CHUNKS / 64];
+    char data[];
+};
+
+
+typedef struct {
+    lchunk *free;
+    lslab *slabs;
+} lheap;
+
+
+static _Thread_local uint64_t heap_live;
+
+
+#ifndef LITHP_MALLOC
+static _Thread_local lheap heaps[LHEAP_KINDS][SLAB_CLASSES];
+
+
+static lslab *
+slab_of(void *p)
+{
+    return (lslab *)((uintptr_t)p & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+
+static uint32_t
+chunk_index(lslab *slab, void *p)
+{
+    return ((char *)p - slab->data) / slab->csize;
+}
+#endif
+
+
+void *
+lheap_alloc(lheap_kind kind, size_t size)
+{
+#ifdef LITHP_MALLOC
+    (void)kind;
+    heap_live++;
+    return lalloc(size);
+#else
+    stats.allocs++;
+    int class = size_class(size);
+    lheap *heap = &heaps[kind][class];
+
+    lslab *slab;
+    void *p;
+    if (heap->free) {
+        stats.hits++;
+        p = heap->free;
+        heap->free = heap->free->next;
+        slab = slab_of(p);
+    } else {
+        slab = heap->slabs;
+        if (!slab || slab->carved == slab->chunks) {
+            slab = aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+            memset(slab, 0, sizeof(lslab));
+            slab->csize = class_size(class);
+            slab->chunks = (SLAB_SIZE - sizeof(lslab)) / slab->csize;
+            slab->next = heap->slabs;
+            heap->slabs = slab;
+            stats.slabs++;
+        }
+        p = slab->data + slab->carved++ * slab->csize;
+    }
+
+    uint32_t i = chunk_index(slab, p);
+    slab->live[i / 64] |= (uint64_t)1 << (i % 64);
+    heap_live++;
+    return p;
+#endif
+}
+
+
+void
+lheap_free(lheap_kind kind, void *p, size_t size)
+{
+    if (in_region(p))
+        return;
+    heap_live--;
+#ifdef LITHP_MALLOC
+    (void)kind;
+    lfree(p, size);
+#else
+    stats.frees++;
+    lslab *slab = slab_of(p);
+    uint32_t i = chunk_index(slab, p);
+    slab->live[i / 64] &= ~((uint64_t)1 << (i % 64));
+
+    lheap *heap = &heaps[kind][size_class(size)];
+    lchunk *c = p;
+    c->next = heap->free;
+    heap->free = c;
+#endif
+}
+
+
+uint64_t
+lheap_live(void)
+{
+    return heap_live;
+}
+
+
+#ifndef LITHP_MALLOC
+/*
+ * Function:  lheap_mark
+ * ---------------------
+ *   Set the mark bit of the object *p*. Return whether it was already
+ *   set.
+ */
+int
+lheap_mark(void *p)
+{
+    lslab *slab = slab_of(p);
+    uint32_t i = chunk_index(slab, p);
+    uint64_t bit = (uint64_t)1 << (i % 64);
+
+    int marked = (slab->mark[i / 64] & bit) != 0;
+    slab->mark[i / 64] |= bit;
+    return marked;
+}
+
+
+int
+lheap_is_marked(void *p)
+{
+    lslab *slab = slab_of(p);
+    uint32_t i = chunk_index(slab, p);
+    return (slab->mark[i / 64] >> (i % 64)) & 1;
+}
+
+
+/*
+ * Function:  lheap_each_unmarked
+ * ------------------------------
+ *   Call *fn* on every object of *kind* that is in use but not marked.
+ *   *fn* may free the object it is given.
+ */
+void
+lheap_each_unmarked(lheap_kind kind, void (*fn)(void *))
+{
+    for (int class = 0; class < SLAB_CLASSES; class++)
+        for (lslab *s = heaps[kind][class].slabs; s; s = s->next)
+            for (uint32_t i = 0; i < s->carved; i++) {
+                uint64_t bit = (uint64_t)1 << (i % 64);
+                if ((s->live[i / 64] & bit) && !(s->mark[i / 64] & bit))
+                    fn(s->data + i * s->csize);
+            }
+}
+
+
+void
+lheap_unmark(void)
+{
+    for (int kind = 0; kind < LHEAP_KINDS; kind++)
+        for (int class = 0; class < SLAB_CLASSES; class++)
+            for (lslab *s = heaps[kind][class].slabs; s; s = s->next)
+                memset(s->mark, 0, sizeof(s->mark));
+}
+#endif
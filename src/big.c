@@ -0,0 +1,558 @@
+/*
+ * big.c
+ * -----
+ *
+ *   Integers of any size. Numbers are fixnums or boxed `LVAL_NUM`s as
+ *   long as they fit an `intmax_t` and only become an `LVAL_BIG` when
+ *   they don't, so the arithmetic builtins get here only once their
+ *   fast path overflows. Every result that fits is turned back into a
+ *   plain number, which means a bignum is never equal to a number.
+ *
+ *   A bignum is a sign and its magnitude, an array of 32 bit limbs with
+ *   the least significant first and no leading zero limbs. The functions
+ *   taking lvals accept numbers and bignums alike, and leave them be.
+ *
+ */
+
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lithp.h"
+
+
+/* below this many limbs schoolbook multiplication beats Karatsuba */
+#define KARATSUBA_CUTOFF 32
+
+/* decimal digits converted at a time, 10^9 fits a limb */
+#define CHUNK_DIGITS 9
+#define CHUNK 1000000000u
+
+
+/* The magnitude and sign of a number or bignum. Numbers keep their
+ * limbs in `small`. */
+typedef struct {
+    const uint32_t *limbs;
+    size_t count;
+    int negative;
+    uint32_t small[2];
+} lmag;
+
+
+static void
+mag_of(lval *v, lmag *m)
+{
+    if (LVAL_TYPE(v) == LVAL_BIG) {
+        m->limbs = v->limbs;
+        m->count = v->nlimbs;
+        m->negative = v->negative;
+        return;
+    }
+
+    intmax_t x = LVAL_NUMBER(v);
+    uintmax_t u = x < 0 ? -(uintmax_t)x : (uintmax_t)x;
+    m->small[0] = (uint32_t)u;
+    m->small[1] = (uint32_t)(u >> 32);
+    m->limbs = m->small;
+    m->count = m->small[1] ? 2 : m->small[0] ? 1 : 0;
+    m->negative = x < 0;
+}
+
+
+/*
+ * Function:  make
+ * ---------------
+ *   Return the integer with the *count* limbs at *limbs*, a `malloc`ed
+ *   array taken over, and the sign *negative*: a number if it fits,
+ *   a bignum otherwise.
+ */
+static lval *
+make(uint32_t *limbs, size_t count, int negative)
+{
+    while (count && !limbs[count - 1])
+        count--;
+
+    if (count <= 2) {
+        uintmax_t u = count ? limbs[0] : 0;
+        if (count == 2)
+            u |= (uintmax_t)limbs[1] << 32;
+        if (u <= (uintmax_t)INTMAX_MAX ||
+            (negative && u == -(uintmax_t)INTMAX_MIN)) {
+            free(limbs);
+            return lval_num(negative ? (intmax_t)-u : (intmax_t)u);
+        }
+    }
+
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(negative));
+    v->type = LVAL_BIG;
+    v->refs = 1;
+    v->limbs = realloc(limbs, sizeof(uint32_t) * count);
+    v->nlimbs = (uint32_t)count;
+    v->negative = negative;
+    return v;
+}
+
+
+/*****************************************************************************/
+/*                                MAGNITUDES                                 */
+/*****************************************************************************/
+
+static int
+mag_cmp(const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    if (an != bn)
+        return an < bn ? -1 : 1;
+    while (an--)
+        if (a[an] != b[an])
+            return a[an] < b[an] ? -1 : 1;
+    return 0;
+}
+
+
+/* *r* = *a* + *b* where *an* >= *bn*, *r* has room for *an* + 1 limbs.
+ * Return the length of *r*. */
+static size_t
+mag_add(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    uint64_t carry = 0;
+    for (size_t i = 0; i < an; i++) {
+        carry += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    r[an] = (uint32_t)carry;
+    return an + 1;
+}
+
+
+/* *r* = *a* - *b* where *a* >= *b*, *r* has room for *an* limbs. */
+static void
+mag_sub(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    int64_t borrow = 0;
+    for (size_t i = 0; i < an; i++) {
+        borrow += (int64_t)a[i] - (i < bn ? b[i] : 0);
+        r[i] = (uint32_t)borrow;
+        borrow = borrow < 0 ? -1 : 0;
+    }
+}
+
+
+/* *r* += *a*, the *rn* limbs of *r* are enough to hold the sum. */
+static void
+mag_add_to(uint32_t *r, size_t rn, const uint32_t *a, size_t an)
+{
+    uint64_t carry = 0;
+    for (size_t i = 0; i < rn && (i < an || carry); i++) {
+        carry += (uint64_t)r[i] + (i < an ? a[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+
+/* *r* -= *a*, which is at most *r*. */
+static void
+mag_sub_from(uint32_t *r, size_t rn, const uint32_t *a, size_t an)
+{
+    int64_t borrow = 0;
+    for (size_t i = 0; i < rn && (i < an || borrow); i++) {
+        borrow += (int64_t)r[i] - (i < an ? a[i] : 0);
+        r[i] = (uint32_t)borrow;
+        borrow = borrow < 0 ? -1 : 0;
+    }
+}
+
+
+/*
+ * Function:  mag_mul
+ * ------------------
+ *   Write the *an* + *bn* limbs of *a* times *b* to *r*, which mustn't
+ *   overlap either. Long operands are split in halves, so that with
+ *   a = a1 B + a0 and b = b1 B + b0
+ *
+ *     a b = a1 b1 B^2 + ((a0 + a1)(b0 + b1) - a0 b0 - a1 b1) B + a0 b0
+ *
+ *   takes three multiplications of half the size instead of four.
+ */
+static void
+mag_mul(uint32_t *r, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    if (an < bn) {
+        const uint32_t *t = a;
+        a = b;
+        b = t;
+        size_t tn = an;
+        an = bn;
+        bn = tn;
+    }
+
+    if (bn < KARATSUBA_CUTOFF) {
+        memset(r, 0, sizeof(uint32_t) * (an + bn));
+        for (size_t i = 0; i < bn; i++) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < an; j++) {
+                carry += (uint64_t)a[j] * b[i] + r[i + j];
+                r[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            r[i + an] = (uint32_t)carry;
+        }
+        return;
+    }
+
+    /* lopsided: *b* times each *bn* limbs of *a* */
+    if (2 * bn <= an) {
+        uint32_t *t = malloc(sizeof(uint32_t) * 2 * bn);
+        memset(r, 0, sizeof(uint32_t) * (an + bn));
+        for (size_t i = 0; i < an; i += bn) {
+            size_t n = an - i < bn ? an - i : bn;
+            mag_mul(t, a + i, n, b, bn);
+            mag_add_to(r + i, an + bn - i, t, n + bn);
+        }
+        free(t);
+        return;
+    }
+
+    /* a0 b0 and a1 b1 go straight to their place in *r* */
+    size_t m = an / 2;
+    size_t a1n = an - m, b1n = bn - m;
+    mag_mul(r, a, m, b, m);
+    mag_mul(r + 2 * m, a + m, a1n, b + m, b1n);
+
+    uint32_t *sa = malloc(sizeof(uint32_t) * (a1n + 1));
+    size_t san = mag_add(sa, a + m, a1n, a, m);
+    size_t sbn = b1n > m ? b1n : m;
+    uint32_t *sb = malloc(sizeof(uint32_t) * (sbn + 1));
+    if (b1n > m)
+        sbn = mag_add(sb, b + m, b1n, b, m);
+    else
+        sbn = mag_add(sb, b, m, b + m, b1n);
+
+    size_t mn = san + sbn;
+    uint32_t *mid = malloc(sizeof(uint32_t) * mn);
+    mag_mul(mid, sa, san, sb, sbn);
+    mag_sub_from(mid, mn, r, 2 * m);
+    mag_sub_from(mid, mn, r + 2 * m, a1n + b1n);
+    while (mn && !mid[mn - 1])
+        mn--;
+    mag_add_to(r + m, an + bn - m, mid, mn);
+
+    free(sa);
+    free(sb);
+    free(mid);
+}
+
+
+/* *a* = *a* times *m* plus *add*, growing its length *n* as needed;
+ * *a* must have room for one more limb. */
+static void
+mag_mul_small(uint32_t *a, size_t *n, uint32_t m, uint32_t add)
+{
+    uint64_t carry = add;
+    for (size_t i = 0; i < *n; i++) {
+        carry += (uint64_t)a[i] * m;
+        a[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    if (carry)
+        a[(*n)++] = (uint32_t)carry;
+}
+
+
+/* *q* = *a* / *d*, returning the remainder. *q* may be *a*. */
+static uint32_t
+mag_div_small(uint32_t *q, const uint32_t *a, size_t an, uint32_t d)
+{
+    uint64_t rem = 0;
+    for (size_t i = an; i-- > 0;) {
+        rem = (rem << 32) | a[i];
+        q[i] = (uint32_t)(rem / d);
+        rem %= d;
+    }
+    return (uint32_t)rem;
+}
+
+
+/*
+ * Function:  mag_div
+ * ------------------
+ *   Write the *an* - *bn* + 1 limbs of *a* / *b* to *q*, for *bn* >= 2
+ *   and *an* >= *bn*. This is Knuth's algorithm D: both are shifted so
+ *   the top bit of *b* is set, then every limb of the quotient is
+ *   guessed from the top two limbs and corrected at most twice.
+ */
+static void
+mag_div(uint32_t *q, const uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    int shift = 0;
+    while (!(b[bn - 1] << shift & 0x80000000u))
+        shift++;
+
+    uint32_t *u = malloc(sizeof(uint32_t) * (an + 1));
+    uint32_t *v = malloc(sizeof(uint32_t) * bn);
+    for (size_t i = bn - 1; i > 0; i--)
+        v[i] = b[i] << shift | (shift ? b[i - 1] >> (32 - shift) : 0);
+    v[0] = b[0] << shift;
+    u[an] = shift ? a[an - 1] >> (32 - shift) : 0;
+    for (size_t i = an - 1; i > 0; i--)
+        u[i] = a[i] << shift | (shift ? a[i - 1] >> (32 - shift) : 0);
+    u[0] = a[0] << shift;
+
+    for (size_t j = an - bn + 1; j-- > 0;) {
+        uint64_t top = (uint64_t)u[j + bn] << 32 | u[j + bn - 1];
+        uint64_t qhat = top / v[bn - 1];
+        uint64_t rhat = top % v[bn - 1];
+        while (qhat >> 32 ||
+               qhat * v[bn - 2] > (rhat << 32 | u[j + bn - 2])) {
+            qhat--;
+            rhat += v[bn - 1];
+            if (rhat >> 32)
+                break;
+        }
+
+        /* u -= qhat v, shifted by j */
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < bn; i++) {
+            uint64_t p = qhat * v[i] + carry;
+            carry = p >> 32;
+            borrow += (int64_t)u[i + j] - (uint32_t)p;
+            u[i + j] = (uint32_t)borrow;
+            borrow = borrow < 0 ? -1 : 0;
+        }
+        borrow += (int64_t)u[j + bn] - (int64_t)carry;
+        u[j + bn] = (uint32_t)borrow;
+
+        /* the guess was one too big, add v back */
+        if (borrow < 0) {
+            qhat--;
+            carry = 0;
+            for (size_t i = 0; i < bn; i++) {
+                carry += (uint64_t)u[i + j] + v[i];
+                u[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            u[j + bn] += (uint32_t)carry;
+        }
+        q[j] = (uint32_t)qhat;
+    }
+
+    free(u);
+    free(v);
+}
+
+
+/*****************************************************************************/
+/*                                ARITHMETIC                                 */
+/*****************************************************************************/
+
+/* *a* plus *b*, negated first if *negate_b* is set. */
+static lval *
+add(lval *a, lval *b, int negate_b)
+{
+    lmag ma, mb;
+    mag_of(a, &ma);
+    mag_of(b, &mb);
+    mb.negative ^= negate_b && mb.count;
+
+    /* the bigger magnitude first */
+    lmag *x = &ma, *y = &mb;
+    if (mag_cmp(x->limbs, x->count, y->limbs, y->count) < 0) {
+        x = &mb;
+        y = &ma;
+    }
+
+    uint32_t *r = malloc(sizeof(uint32_t) * (x->count + 1));
+    if (x->negative == y->negative) {
+        size_t n = mag_add(r, x->limbs, x->count, y->limbs, y->count);
+        return make(r, n, x->negative);
+    }
+    mag_sub(r, x->limbs, x->count, y->limbs, y->count);
+    return make(r, x->count, x->negative);
+}
+
+
+lval *
+lbig_add(lval *a, lval *b)
+{
+    return add(a, b, 0);
+}
+
+
+lval *
+lbig_sub(lval *a, lval *b)
+{
+    return add(a, b, 1);
+}
+
+
+lval *
+lbig_mul(lval *a, lval *b)
+{
+    lmag x, y;
+    mag_of(a, &x);
+    mag_of(b, &y);
+    if (!x.count || !y.count)
+        return lval_num(0);
+
+    uint32_t *r = malloc(sizeof(uint32_t) * (x.count + y.count));
+    mag_mul(r, x.limbs, x.count, y.limbs, y.count);
+    return make(r, x.count + y.count, x.negative != y.negative);
+}
+
+
+/*
+ * Function:  lbig_div
+ * -------------------
+ *   Return *a* / *b* rounded towards zero like C does. *b* mustn't be
+ *   zero.
+ */
+lval *
+lbig_div(lval *a, lval *b)
+{
+    lmag x, y;
+    mag_of(a, &x);
+    mag_of(b, &y);
+    if (mag_cmp(x.limbs, x.count, y.limbs, y.count) < 0)
+        return lval_num(0);
+
+    size_t n = x.count - y.count + 1;
+    uint32_t *q = malloc(sizeof(uint32_t) * x.count);
+    if (y.count == 1) {
+        mag_div_small(q, x.limbs, x.count, y.limbs[0]);
+        n = x.count;
+    } else
+        mag_div(q, x.limbs, x.count, y.limbs, y.count);
+    return make(q, n, x.negative != y.negative);
+}
+
+
+int
+lbig_cmp(lval *a, lval *b)
+{
+    lmag x, y;
+    mag_of(a, &x);
+    mag_of(b, &y);
+    if (x.negative != y.negative)
+        return x.negative ? -1 : 1;
+    int c = mag_cmp(x.limbs, x.count, y.limbs, y.count);
+    return x.negative ? -c : c;
+}
+
+
+double
+lbig_to_double(lval *a)
+{
+    lmag x;
+    mag_of(a, &x);
+    double r = 0;
+    for (size_t i = x.count; i-- > 0;)
+        r = r * 4294967296.0 + x.limbs[i];
+    return x.negative ? -r : r;
+}
+
+
+/*
+ * Function:  lbig_eq_float
+ * ------------------------
+ *   Whether the bignum *a* is exactly the float *f*.
+ */
+int
+lbig_eq_float(lval *a, double f)
+{
+    if (!isfinite(f) || f != floor(f) || (f < 0) != a->negative)
+        return 0;
+
+    /* |f| = mantissa 2^exp with a 64 bit integer mantissa */
+    int exp;
+    uint64_t mantissa = (uint64_t)ldexp(frexp(fabs(f), &exp), 64);
+    exp -= 64;
+    if (exp < 0)
+        return 0; /* too small for a bignum */
+
+    size_t count = (size_t)exp / 32 + 3;
+    uint32_t *r = calloc(count, sizeof(uint32_t));
+    int bits = exp % 32;
+    r[exp / 32] = (uint32_t)(mantissa << bits);
+    r[exp / 32 + 1] = (uint32_t)(mantissa >> (32 - bits));
+    r[exp / 32 + 2] = bits ? (uint32_t)(mantissa >> (64 - bits)) : 0;
+    while (count && !r[count - 1])
+        count--;
+
+    int eq = mag_cmp(a->limbs, a->nlimbs, r, count) == 0;
+    free(r);
+    return eq;
+}
+
+
+/*****************************************************************************/
+/*                                  DECIMAL                                  */
+/*****************************************************************************/
+
+/*
+ * Function:  lbig_read
+ * --------------------
+ *   Return the integer written in decimal in *s*, an optional minus
+ *   followed by digits. Nine digits are taken in at a time.
+ */
+lval *
+lbig_read(char *s)
+{
+    int negative = *s == '-';
+    s += negative;
+    size_t len = strlen(s);
+
+    uint32_t *r = malloc(sizeof(uint32_t) * (len / CHUNK_DIGITS + 2));
+    size_t n = 0;
+    size_t first = len % CHUNK_DIGITS ? len % CHUNK_DIGITS : CHUNK_DIGITS;
+    for (size_t i = 0; i < len; i += i ? CHUNK_DIGITS : first) {
+        size_t digits = i ? CHUNK_DIGITS : first;
+        uint32_t chunk = 0, scale = 1;
+        for (size_t k = 0; k < digits; k++) {
+            chunk = chunk * 10 + (uint32_t)(s[i + k] - '0');
+            scale *= 10;
+        }
+        mag_mul_small(r, &n, scale, chunk);
+    }
+    return make(r, n, negative);
+}
+
+
+/*
+ * Function:  lbig_to_str
+ * ----------------------
+ *   Return *a* in decimal, to be `free`d. Nine digits come off at a
+ *   time.
+ */
+char *
+lbig_to_str(lval *a)
+{
+    lmag x;
+    mag_of(a, &x);
+
+    /* a limb is less than ten digits */
+    size_t n = x.count;
+    uint32_t *q = malloc(sizeof(uint32_t) * (n + 1));
+    uint32_t *chunks = malloc(sizeof(uint32_t) * (n * 10 / CHUNK_DIGITS + 2));
+    memcpy(q, x.limbs, sizeof(uint32_t) * n);
+    size_t count = 0;
+    do {
+        chunks[count++] = mag_div_small(q, q, n, CHUNK);
+        while (n && !q[n - 1])
+            n--;
+    } while (n);
+
+    char *s = malloc(count * CHUNK_DIGITS + 2);
+    char *p = s + sprintf(s, "%s%u", x.negative ? "-" : "", chunks[count - 1]);
+    for (size_t i = count - 1; i-- > 0;)
+        p += sprintf(p, "%09u", chunks[i]);
+
+    free(q);
+    free(chunks);
+    return s;
+}
@@ -31,9 +31,9 @@
 
 #define ASSERT_TYPE(func, args, index, expect)                                 \
     ASSERT(                                                                    \
-        args, args->cell[index]->type == expect,                               \
+        args, LVAL_TYPE(args->cell[index]) == expect,                          \
         "'%s' expected type %s at %i, but got %s.", func,                      \
-        ltype_to_name(expect), index, ltype_to_name(args->cell[index]->type))
+        ltype_to_name(expect), index, ltype_to_name(LVAL_TYPE(args->cell[index])))
 
 #define ASSERT_NOT_EMPTY(func, args, index)                                    \
     ASSERT(                                                                    \
@@ -49,15 +49,28 @@ builtin_list(lenv *e, lval *a)
 }
 
 
+/*
+ * Function:  builtin_eval_tail
+ * ----------------------------
+ *   Check the arguments of `eval` and return the expression it evaluates,
+ *   or an error. The VM evaluates it in tail position.
+ */
 lval *
-builtin_eval(lenv *e, lval *a)
+builtin_eval_tail(lval *a)
 {
     ASSERT_ARG_COUNT("eval", a, 1);
     ASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
 
-    lval *x = lval_take(a, 0);
+    lval *x = lval_unshare(lval_take(a, 0));
     x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    return x;
+}
+
+
+lval *
+builtin_eval(lenv *e, lval *a)
+{
+    return lval_eval(e, builtin_eval_tail(a));
 }
 
 
@@ -69,9 +82,9 @@ builtin_head(lenv *e, lval *a)
     ASSERT_NOT_EMPTY("head", a, 0);
 
     lval *v = lval_take(a, 0);
-    while (v->count > 1)
-        lval_cleanup(lval_pop(v, 1));
-    return v;
+    lval *x = lval_add(lval_qexpr(), lval_copy(v->cell[0]));
+    lval_cleanup(v);
+    return x;
 }
 
 
@@ -82,7 +95,7 @@ builtin_tail(lenv *e, lval *a)
     ASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
     ASSERT_NOT_EMPTY("tail", a, 0);
 
-    lval *v = lval_take(a, 0);
+    lval *v = lval_unshare(lval_take(a, 0));
     lval_cleanup(lval_pop(v, 0));
     return v;
 }
@@ -103,8 +116,117 @@ builtin_join(lenv *e, lval *a)
 }
 
 
+/* Vectors are q-expressions that aren't code: the same array of cells,
+ * indexed in O(1). Unlike every other value they are changed in place,
+ * and everything referring to one sees the change, so a loop setting or
+ * pushing onto a vector bound to a name doesn't copy it every time. */
+
+#define ASSERT_INDEX(func, args, vec, index)                                   \
+    ASSERT(                                                                    \
+        args,                                                                  \
+        LVAL_NUMBER(index) >= 0 &&                                             \
+            (uintmax_t)LVAL_NUMBER(index) < (vec)->count,                      \
+        "'%s' index %li out of range for a vector of %lu.", func,              \
+        LVAL_NUMBER(index), (vec)->count)
+
+/* A vector inside itself would never be freed, printed or compared. */
+#define ASSERT_NOT_INSIDE(func, args, vec, x)                                  \
+    ASSERT(                                                                    \
+        args, !lval_contains(x, vec),                                          \
+        "'%s' can't put a vector inside itself.", func)
+
+
 lval *
-builtin_var(lenv *e, lval *a, char *func)
+builtin_vec(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("vec", a, 1);
+    ASSERT_TYPE("vec", a, 0, LVAL_QEXPR);
+
+    lval *v = lval_unshare(lval_take(a, 0));
+    v->type = LVAL_VEC;
+    for (uint64_t i = 0; i < v->count; i++) {
+        lval *x = lval_vec_copy(v->cell[i]);
+        lval_cleanup(v->cell[i]);
+        v->cell[i] = x;
+    }
+    return v;
+}
+
+
+lval *
+builtin_vec_list(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("vec-list", a, 1);
+    ASSERT_TYPE("vec-list", a, 0, LVAL_VEC);
+
+    lval *v = lval_unshare(lval_take(a, 0));
+    v->type = LVAL_QEXPR;
+    return v;
+}
+
+
+lval *
+builtin_vec_get(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("vec-get", a, 2);
+    ASSERT_TYPE("vec-get", a, 0, LVAL_VEC);
+    ASSERT_TYPE("vec-get", a, 1, LVAL_NUM);
+    ASSERT_INDEX("vec-get", a, a->cell[0], a->cell[1]);
+
+    lval *x = lval_copy(a->cell[0]->cell[LVAL_NUMBER(a->cell[1])]);
+    lval_cleanup(a);
+    return x;
+}
+
+
+lval *
+builtin_vec_set(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("vec-set", a, 3);
+    ASSERT_TYPE("vec-set", a, 0, LVAL_VEC);
+    ASSERT_TYPE("vec-set", a, 1, LVAL_NUM);
+    ASSERT_INDEX("vec-set", a, a->cell[0], a->cell[1]);
+    ASSERT_NOT_INSIDE("vec-set", a, a->cell[0], a->cell[2]);
+
+    lval *v = lval_pop(a, 0);
+    intmax_t i = LVAL_NUMBER(a->cell[0]);
+    lval_cleanup(v->cell[i]);
+    v->cell[i] = lval_pop(a, 1);
+    lval_cleanup(a);
+    return v;
+}
+
+
+lval *
+builtin_vec_len(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("vec-len", a, 1);
+    ASSERT_TYPE("vec-len", a, 0, LVAL_VEC);
+
+    intmax_t len = a->cell[0]->count;
+    lval_cleanup(a);
+    return lval_num(len);
+}
+
+
+/* Appending doubles the array when it's full, see `lval_push`. */
+lval *
+builtin_vec_push(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("vec-push", a, 2);
+    ASSERT_TYPE("vec-push", a, 0, LVAL_VEC);
+    ASSERT_NOT_INSIDE("vec-push", a, a->cell[0], a->cell[1]);
+
+    lval *v = lval_pop(a, 0);
+    v = lval_push(v, lval_pop(a, 0));
+    lval_cleanup(a);
+    return v;
+}
+
+
+/* `def` and `=`, binding with *put* */
+static lval *
+builtin_var(lenv *e, lval *a, char *func, void (*put)(lenv *, lval *, lval *))
 {
     ASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
@@ -112,20 +234,15 @@ builtin_var(lenv *e, lval *a, char *func)
     /* ensure valid symbols */
     for (uint16_t i = 0; i < syms->count; i++)
         ASSERT(
-            a, syms->cell[i]->type == LVAL_SYM, "'%s' cannot define non-symbol",
+            a, LVAL_TYPE(syms->cell[i]) == LVAL_SYM, "'%s' cannot define non-symbol",
             func);
 
     ASSERT(
         a, (syms->count == a->count - 1),
         "'%s' can only define same number of values and symbols", func);
 
-    for (uint16_t i = 0; i < syms->count; i++) {
-        if (strcmp(func, "def") == 0) {
-            lenv_put_global(e, syms->cell[i], a->cell[i + 1]);
-        } else if (strcmp(func, "=") == 0) {
-            lenv_put(e, syms->cell[i], a->cell[i + 1]);
-        }
-    }
+    for (uint16_t i = 0; i < syms->count; i++)
+        put(e, syms->cell[i], a->cell[i + 1]);
 
     lval_cleanup(a);
     return lval_sexpr();
@@ -135,14 +252,14 @@ builtin_var(lenv *e, lval *a, char *func)
 lval *
 builtin_def(lenv *e, lval *a)
 {
-    return builtin_var(e, a, "def");
+    return builtin_var(e, a, "def", lenv_put_global);
 }
 
 
 lval *
 builtin_put(lenv *e, lval *a)
 {
-    return builtin_var(e, a, "=");
+    return builtin_var(e, a, "=", lenv_put);
 }
 
 
@@ -156,15 +273,16 @@ builtin_lambda(lenv *e, lval *a)
     /* Verify that first Q-Expression only contains symbols */
     for (uint64_t i = 0; i < a->cell[0]->count; i++)
         ASSERT(
-            a, (a->cell[0]->cell[i]->type == LVAL_SYM),
+            a, (LVAL_TYPE(a->cell[0]->cell[i]) == LVAL_SYM),
             "Cannot define non-symbol. Got %s, expected %s.",
-            ltype_to_name(a->cell[0]->cell[i]->type), ltype_to_name(LVAL_SYM));
+            ltype_to_name(LVAL_TYPE(a->cell[0]->cell[i])),
+            ltype_to_name(LVAL_SYM));
 
     lval *formals = lval_pop(a, 0);
     lval *body = lval_pop(a, 0);
     lval_cleanup(a);
 
-    return lval_lambda(formals, body);
+    return lval_lambda(e, formals, body);
 }
 
 
@@ -195,44 +313,354 @@ builtin_error(lenv *e, lval *a)
 
 
 lval *
-builtin_op(lenv *e, lval *a, char *op)
+lval_stat(char *name, uint64_t value)
 {
-    /* Ensure that all args are numbers */
-    for (uint64_t i = 0; i < a->count; i++)
-        if (a->cell[i]->type != LVAL_NUM) {
-            lval_cleanup(a);
-            return lval_err("Can only operate on numbers!");
-        }
+    return lval_add(lval_add(lval_qexpr(), lval_str(name)), lval_num(value));
+}
 
-    lval *x = lval_pop(a, 0);
 
-    if ((strcmp(op, "-") == 0) && a->count == 0)
-        x->number = -x->number;
+/*
+ * Function:  builtin_alloc_stats
+ * ------------------------------
+ *   Return the allocator counters as a q-expression of `{name value}`
+ *   pairs. `hits` out of `allocs` were reused from a free list, `region`
+ *   weren't allocations at all, see `lregion_alloc`.
+ *
+ *   The argument is ignored, call it like `(alloc-stats ())`.
+ */
+lval *
+builtin_alloc_stats(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("alloc-stats", a, 1);
+    lval_cleanup(a);
+
+    lalloc_stats s = lalloc_get_stats();
+    lval *x = lval_qexpr();
+    x = lval_add(x, lval_stat("allocs", s.allocs));
+    x = lval_add(x, lval_stat("frees", s.frees));
+    x = lval_add(x, lval_stat("hits", s.hits));
+    x = lval_add(x, lval_stat("slabs", s.slabs));
+    x = lval_add(x, lval_stat("large", s.large));
+    x = lval_add(x, lval_stat("region", s.region));
+    return x;
+}
 
-    while (a->count > 0) {
-        lval *y = lval_pop(a, 0);
 
-        if (strcmp(op, "+") == 0)
-            x->number += y->number;
-        if (strcmp(op, "-") == 0)
-            x->number -= y->number;
-        if (strcmp(op, "*") == 0)
-            x->number *= y->number;
-        if (strcmp(op, "/") == 0) {
-            if (y->number == 0) {
+/*
+ * Function:  builtin_cache_stats
+ * ------------------------------
+ *   Return how often calls found their function in the inline cache,
+ *   as a q-expression of `{name value}` pairs like `alloc-stats`.
+ */
+lval *
+builtin_cache_stats(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("cache-stats", a, 1);
+    lval_cleanup(a);
+
+    lcache_stats s = lenv_get_cache_stats();
+    lval *x = lval_qexpr();
+    x = lval_add(x, lval_stat("hits", s.hits));
+    x = lval_add(x, lval_stat("misses", s.misses));
+    return x;
+}
+
+
+/*
+ * Function:  builtin_gc_stats
+ * ---------------------------
+ *   Print what the garbage collector has been up to. The argument is
+ *   ignored, call it like `(gc-stats ())`.
+ */
+lval *
+builtin_gc_stats(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("gc-stats", a, 1);
+    lval_cleanup(a);
+
+#ifdef LITHP_MALLOC
+    puts("gc: disabled, built with LITHP_MALLOC");
+#else
+    gc_stats s = gc_get_stats();
+    printf(
+        "gc: %lu collections, %lu objects freed\n", s.collections, s.freed);
+    printf(
+        "gc: pauses %luus total, %luus max, %luus last\n", s.pause_total,
+        s.pause_max, s.pause_last);
+    printf(
+        "gc: %lu live objects, next collection at %lu (growth %lu%%)\n",
+        s.live, s.threshold, s.growth);
+#endif
+    return lval_sexpr();
+}
+
+
+/*
+ * Function:  builtin_gc_growth
+ * ----------------------------
+ *   Set how big, in percent of what survived the last collection, the
+ *   heap may grow before it is collected again.
+ */
+lval *
+builtin_gc_growth(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("gc-growth", a, 1);
+    ASSERT_TYPE("gc-growth", a, 0, LVAL_NUM);
+    ASSERT(
+        a, LVAL_NUMBER(a->cell[0]) >= 100, "'%s' must be at least 100",
+        "gc-growth");
+
+    gc_set_growth(LVAL_NUMBER(a->cell[0]));
+    lval_cleanup(a);
+    return lval_sexpr();
+}
+
+
+lval *
+builtin_max_depth(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("max-depth", a, 1);
+    ASSERT_TYPE("max-depth", a, 0, LVAL_NUM);
+    ASSERT(
+        a, LVAL_NUMBER(a->cell[0]) >= 1, "'%s' must be at least 1",
+        "max-depth");
+
+    lvm_set_max_depth(LVAL_NUMBER(a->cell[0]));
+    lval_cleanup(a);
+    return lval_sexpr();
+}
+
+
+/*
+ * Function:  builtin_jit
+ * ----------------------
+ *   Turn native code for hot numeric functions off with 0, on with 1,
+ *   or on with every result checked against the interpreter with 2.
+ */
+lval *
+builtin_jit(lenv *e, lval *a)
+{
+    ASSERT_ARG_COUNT("jit", a, 1);
+    ASSERT_TYPE("jit", a, 0, LVAL_NUM);
+    ASSERT(
+        a,
+        LVAL_NUMBER(a->cell[0]) >= LJIT_OFF &&
+            LVAL_NUMBER(a->cell[0]) <= LJIT_VERIFY,
+        "'%s' must be 0, 1 or 2", "jit");
+
+    ljit_set_mode((int)LVAL_NUMBER(a->cell[0]));
+    lval_cleanup(a);
+    return lval_sexpr();
+}
+
+
+/* Each arithmetic builtin has a loop of its own over the argument array
+ * for numbers that fit an `intmax_t`. Once a result doesn't, or another
+ * kind of number comes up, the rest is done by `builtin_arith`. */
+
+#ifdef __GNUC__
+#define ADD_OVERFLOW(a, b, r) __builtin_add_overflow(a, b, r)
+#define SUB_OVERFLOW(a, b, r) __builtin_sub_overflow(a, b, r)
+#define MUL_OVERFLOW(a, b, r) __builtin_mul_overflow(a, b, r)
+#else
+static int
+add_overflow(intmax_t a, intmax_t b, intmax_t *r)
+{
+    if ((b > 0 && a > INTMAX_MAX - b) || (b < 0 && a < INTMAX_MIN - b))
+        return 1;
+    *r = a + b;
+    return 0;
+}
+
+
+static int
+sub_overflow(intmax_t a, intmax_t b, intmax_t *r)
+{
+    if ((b < 0 && a > INTMAX_MAX + b) || (b > 0 && a < INTMAX_MIN + b))
+        return 1;
+    *r = a - b;
+    return 0;
+}
+
+
+static int
+mul_overflow(intmax_t a, intmax_t b, intmax_t *r)
+{
+    if (a > 0 ? (b > 0 ? a > INTMAX_MAX / b : b < INTMAX_MIN / a)
+              : (b > 0 ? a < INTMAX_MIN / b : a != 0 && b < INTMAX_MAX / a))
+        return 1;
+    *r = a * b;
+    return 0;
+}
+
+#define ADD_OVERFLOW(a, b, r) add_overflow(a, b, r)
+#define SUB_OVERFLOW(a, b, r) sub_overflow(a, b, r)
+#define MUL_OVERFLOW(a, b, r) mul_overflow(a, b, r)
+#endif
+
+
+#define IS_NUMBER(x)                                                           \
+    (LVAL_TYPE(x) == LVAL_NUM || LVAL_TYPE(x) == LVAL_FLOAT ||                 \
+     LVAL_TYPE(x) == LVAL_BIG)
+
+#define ASSERT_NUMBERS(args)                                                   \
+    for (uint64_t i = 0; i < args->count; i++)                                 \
+        ASSERT(                                                                \
+            args, IS_NUMBER(args->cell[i]), "Can only operate on %s!",         \
+            "numbers")
+
+
+static double
+as_float(lval *x)
+{
+    switch (LVAL_TYPE(x)) {
+    case LVAL_FLOAT:
+        return x->fnumber;
+    case LVAL_BIG:
+        return lbig_to_double(x);
+    default:
+        return (double)LVAL_NUMBER(x);
+    }
+}
+
+
+/*
+ * Function:  sum_floats, product_floats
+ * -------------------------------------
+ *   Reduce the *n* numbers at *v* in floats, four lanes at a time with
+ *   vector instructions when built by GCC or clang. The lanes are
+ *   combined at the end, so the last digit can differ from adding one
+ *   by one, as with any parallel sum.
+ */
+#ifdef __GNUC__
+typedef double lfloat4 __attribute__((vector_size(4 * sizeof(double))));
+
+#define REDUCE_FLOATS(name, op, unit)                                          \
+    static double name(lval **v, uint64_t n)                                   \
+    {                                                                          \
+        lfloat4 acc = {unit, unit, unit, unit};                                \
+        uint64_t i = 0;                                                        \
+        for (; i + 4 <= n; i += 4) {                                           \
+            lfloat4 x = {                                                      \
+                as_float(v[i]), as_float(v[i + 1]), as_float(v[i + 2]),        \
+                as_float(v[i + 3])};                                           \
+            acc = acc op x;                                                    \
+        }                                                                      \
+        double r = (acc[0] op acc[1]) op(acc[2] op acc[3]);                    \
+        for (; i < n; i++)                                                     \
+            r = r op as_float(v[i]);                                           \
+        return r;                                                              \
+    }
+#else
+#define REDUCE_FLOATS(name, op, unit)                                          \
+    static double name(lval **v, uint64_t n)                                   \
+    {                                                                          \
+        double r = unit;                                                       \
+        for (uint64_t i = 0; i < n; i++)                                       \
+            r = r op as_float(v[i]);                                           \
+        return r;                                                              \
+    }
+#endif
+
+REDUCE_FLOATS(sum_floats, +, 0.0)
+REDUCE_FLOATS(product_floats, *, 1.0)
+
+
+/*
+ * Function:  builtin_add_str
+ * --------------------------
+ *   `+` on strings: concatenate them all into one, allocated once.
+ */
+static lval *
+builtin_add_str(lval *a)
+{
+    size_t len = 0;
+    for (uint64_t i = 0; i < a->count; i++) {
+        ASSERT(
+            a, LVAL_TYPE(a->cell[i]) == LVAL_STR,
+            "Not a supported type for %s", "+");
+        len += strlen(a->cell[i]->str);
+    }
+
+    lval *value = lval_unshare(lval_pop(a, 0));
+    size_t used = strlen(value->str);
+    value->str = realloc(value->str, len + 1);
+    for (uint64_t i = 0; i < a->count; i++) {
+        size_t n = strlen(a->cell[i]->str);
+        memcpy(value->str + used, a->cell[i]->str, n + 1);
+        used += n;
+    }
+
+    lval_cleanup(a);
+    return value;
+}
+
+
+/*
+ * Function:  builtin_arith
+ * ------------------------
+ *   Apply *op*, one of `+`, `-`, `*` and `/`, to *x* and argument *i*
+ *   of *a* on, all of them numbers. *x* is the result of the arguments
+ *   before. Integers go on as bignums where needed, from the first float
+ *   on the rest is done in floats.
+ */
+static lval *
+builtin_arith(lval *a, char op, lval *x, uint64_t i)
+{
+    for (; i < a->count; i++) {
+        lval *y = a->cell[i];
+        if (LVAL_TYPE(x) == LVAL_FLOAT || LVAL_TYPE(y) == LVAL_FLOAT)
+            break;
+
+        lval *r;
+        switch (op) {
+        case '+':
+            r = lbig_add(x, y);
+            break;
+        case '-':
+            r = lbig_sub(x, y);
+            break;
+        case '*':
+            r = lbig_mul(x, y);
+            break;
+        default:
+            if (LVAL_TYPE(y) == LVAL_NUM && LVAL_NUMBER(y) == 0) {
                 lval_cleanup(x);
-                lval_cleanup(y);
-                x = lval_err("Division by Zero!");
-                break;
+                lval_cleanup(a);
+                return lval_err("Division by Zero!");
             }
-            x->number /= y->number;
+            r = lbig_div(x, y);
+            break;
         }
-
-        lval_cleanup(y);
+        lval_cleanup(x);
+        x = r;
+    }
+    if (i == a->count) {
+        lval_cleanup(a);
+        return x;
     }
 
+    /* dividing floats by zero gives infinity or NaN */
+    double r = as_float(x);
+    lval_cleanup(x);
+    switch (op) {
+    case '+':
+        r += sum_floats(a->cell + i, a->count - i);
+        break;
+    case '*':
+        r *= product_floats(a->cell + i, a->count - i);
+        break;
+    case '-':
+        for (; i < a->count; i++)
+            r -= as_float(a->cell[i]);
+        break;
+    default:
+        for (; i < a->count; i++)
+            r /= as_float(a->cell[i]);
+        break;
+    }
     lval_cleanup(a);
-    return x;
+    return lval_float(r);
 }
 
 
@@ -245,148 +673,214 @@ builtin_op(lenv *e, lval *a, char *op)
 lval *
 builtin_add(lenv *env, lval *sexpr)
 {
-    lval *value = lval_pop(sexpr, 0);
-
-    while (sexpr->count > 0) {
-        lval *next = lval_pop(sexpr, 0);
-        switch(value->type) {
-            case LVAL_NUM:
-                value->number += next->number;
-                break;
-            case LVAL_STR:
-                strcat(value->str, next->str);
-                break;
-            default:
-                value = lval_err("Not a supported type for +");
+    if (LVAL_TYPE(sexpr->cell[0]) == LVAL_STR)
+        return builtin_add_str(sexpr);
+
+    intmax_t sum = 0;
+    for (uint64_t i = 0; i < sexpr->count; i++) {
+        lval *next = sexpr->cell[i];
+        intmax_t r;
+        if (LVAL_TYPE(next) == LVAL_NUM &&
+            !ADD_OVERFLOW(sum, LVAL_NUMBER(next), &r)) {
+            sum = r;
+            continue;
         }
-        lval_cleanup(next);
+
+        for (uint64_t j = i; j < sexpr->count; j++)
+            ASSERT(
+                sexpr, IS_NUMBER(sexpr->cell[j]),
+                "Not a supported type for %s", "+");
+        return builtin_arith(sexpr, '+', lval_num(sum), i);
     }
+
     lval_cleanup(sexpr);
-    return value;
+    return lval_num(sum);
 }
 
 
 lval *
 builtin_sub(lenv *e, lval *a)
 {
-    return builtin_op(e, a, "-");
+    ASSERT_NUMBERS(a);
+
+    lval *first = a->cell[0];
+    if (a->count == 1 && LVAL_TYPE(first) == LVAL_FLOAT) {
+        double x = first->fnumber;
+        lval_cleanup(a);
+        return lval_float(-x);
+    }
+    if (a->count > 1 && LVAL_TYPE(first) != LVAL_NUM)
+        return builtin_arith(a, '-', lval_copy(first), 1);
+
+    /* `(- x)` is 0 - x */
+    uint64_t i = a->count == 1 ? 0 : 1;
+    intmax_t number = i ? LVAL_NUMBER(first) : 0;
+    for (; i < a->count; i++) {
+        intmax_t r;
+        if (LVAL_TYPE(a->cell[i]) != LVAL_NUM ||
+            SUB_OVERFLOW(number, LVAL_NUMBER(a->cell[i]), &r))
+            return builtin_arith(a, '-', lval_num(number), i);
+        number = r;
+    }
+
+    lval_cleanup(a);
+    return lval_num(number);
 }
 
 
 lval *
 builtin_mul(lenv *e, lval *a)
 {
-    return builtin_op(e, a, "*");
+    ASSERT_NUMBERS(a);
+
+    intmax_t number = 1;
+    for (uint64_t i = 0; i < a->count; i++) {
+        intmax_t r;
+        if (LVAL_TYPE(a->cell[i]) != LVAL_NUM ||
+            MUL_OVERFLOW(number, LVAL_NUMBER(a->cell[i]), &r))
+            return builtin_arith(a, '*', lval_num(number), i);
+        number = r;
+    }
+
+    lval_cleanup(a);
+    return lval_num(number);
 }
 
 
 lval *
 builtin_div(lenv *e, lval *a)
 {
-    return builtin_op(e, a, "/");
+    ASSERT_NUMBERS(a);
+
+    if (LVAL_TYPE(a->cell[0]) != LVAL_NUM)
+        return builtin_arith(a, '/', lval_copy(a->cell[0]), 1);
+
+    intmax_t number = LVAL_NUMBER(a->cell[0]);
+    for (uint64_t i = 1; i < a->count; i++) {
+        lval *y = a->cell[i];
+        if (LVAL_TYPE(y) != LVAL_NUM || LVAL_NUMBER(y) == 0 ||
+            (number == INTMAX_MIN && LVAL_NUMBER(y) == -1))
+            return builtin_arith(a, '/', lval_num(number), i);
+        number /= LVAL_NUMBER(y);
+    }
+
+    lval_cleanup(a);
+    return lval_num(number);
 }
 
 
+/*
+ * Function:  builtin_if_tail
+ * --------------------------
+ *   Check the arguments of `if` and return the branch it takes, or an
+ *   error. The VM evaluates it in tail position.
+ */
 lval *
-builtin_if(lenv *e, lval *a)
+builtin_if_tail(lval *a)
 {
     ASSERT_ARG_COUNT("if", a, 3);
     ASSERT_TYPE("if", a, 0, LVAL_NUM);
     ASSERT_TYPE("if", a, 1, LVAL_QEXPR);
     ASSERT_TYPE("if", a, 2, LVAL_QEXPR);
 
-    lval *x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
-
-    if (a->cell[0]->number) {
-        x = lval_eval(e, lval_pop(a, 1));
+    lval *branch;
+    if (LVAL_NUMBER(a->cell[0])) {
+        branch = lval_pop(a, 1);
     } else {
-        x = lval_eval(e, lval_pop(a, 2));
+        branch = lval_pop(a, 2);
     }
-
     lval_cleanup(a);
-    return x;
+
+    branch = lval_unshare(branch);
+    branch->type = LVAL_SEXPR;
+    return branch;
 }
 
 
 lval *
-builtin_ord(lenv *e, lval *a, char *op)
+builtin_if(lenv *e, lval *a)
 {
-    ASSERT_ARG_COUNT(op, a, 2);
-    ASSERT_TYPE(op, a, 0, LVAL_NUM);
-    ASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-    int r; // bool?
-    if (strcmp(op, ">") == 0) {
-        r = (a->cell[0]->number > a->cell[1]->number);
-    } else if (strcmp(op, "<") == 0) {
-        r = (a->cell[0]->number < a->cell[1]->number);
-    } else if (strcmp(op, ">=") == 0) {
-        r = (a->cell[0]->number >= a->cell[1]->number);
-    } else /* (strcmp (op, "<=") == 0) */
-    {
-        r = (a->cell[0]->number <= a->cell[1]->number);
-    }
-
-    lval_cleanup(a);
-    return lval_num(r);
+    return lval_eval(e, builtin_if_tail(a));
 }
 
 
-lval *
-builtin_cmp(lenv *e, lval *a, char *op)
-{
-    ASSERT_ARG_COUNT(op, a, 2);
-
-    int r = lval_eq(a->cell[0], a->cell[1]);
-    if (strcmp(op, "!=") == 0)
-        r = !r;
+#define ASSERT_ORD(func, args)                                                 \
+    ASSERT_ARG_COUNT(func, args, 2);                                           \
+    for (int i = 0; i < 2; i++)                                                \
+        ASSERT(                                                                \
+            args, IS_NUMBER(args->cell[i]),                                    \
+            "'%s' expected type %s at %i, but got %s.", func,                  \
+            ltype_to_name(LVAL_NUM), i,                                        \
+            ltype_to_name(LVAL_TYPE(args->cell[i])))
 
-    lval_cleanup(a);
-    return lval_num(r);
-}
+/* Integers are compared exactly, as floats once there is one. */
+#define ORD(args, op)                                                          \
+    (LVAL_TYPE(args->cell[0]) == LVAL_NUM &&                                   \
+             LVAL_TYPE(args->cell[1]) == LVAL_NUM                              \
+         ? LVAL_NUMBER(args->cell[0]) op LVAL_NUMBER(args->cell[1])            \
+     : LVAL_TYPE(args->cell[0]) == LVAL_FLOAT ||                               \
+             LVAL_TYPE(args->cell[1]) == LVAL_FLOAT                            \
+         ? as_float(args->cell[0]) op as_float(args->cell[1])                  \
+         : lbig_cmp(args->cell[0], args->cell[1]) op 0)
 
 
 lval *
 builtin_gt(lenv *e, lval *a)
 {
-    return builtin_ord(e, a, ">");
+    ASSERT_ORD(">", a);
+    int r = ORD(a, >);
+    lval_cleanup(a);
+    return lval_num(r);
 }
 
 
 lval *
 builtin_lt(lenv *e, lval *a)
 {
-    return builtin_ord(e, a, "<");
+    ASSERT_ORD("<", a);
+    int r = ORD(a, <);
+    lval_cleanup(a);
+    return lval_num(r);
 }
 
 
 lval *
 builtin_ge(lenv *e, lval *a)
 {
-    return builtin_ord(e, a, ">=");
+    ASSERT_ORD(">=", a);
+    int r = ORD(a, >=);
+    lval_cleanup(a);
+    return lval_num(r);
 }
 
 
 lval *
 builtin_le(lenv *e, lval *a)
 {
-    return builtin_ord(e, a, "<=");
+    ASSERT_ORD("<=", a);
+    int r = ORD(a, <=);
+    lval_cleanup(a);
+    return lval_num(r);
 }
 
 
 lval *
 builtin_eq(lenv *e, lval *a)
 {
-    return builtin_cmp(e, a, "==");
+    ASSERT_ARG_COUNT("==", a, 2);
+    int r = lval_eq(a->cell[0], a->cell[1]);
+    lval_cleanup(a);
+    return lval_num(r);
 }
 
 
 lval *
 builtin_ne(lenv *e, lval *a)
 {
-    return builtin_cmp(e, a, "!=");
+    ASSERT_ARG_COUNT("!=", a, 2);
+    int r = !lval_eq(a->cell[0], a->cell[1]);
+    lval_cleanup(a);
+    return lval_num(r);
 }
 
 
@@ -407,20 +901,26 @@ builtin_import(lenv *e, lval *a)
     filename[len + 1] = 't';
     filename[len + 2] = 'h';
     filename[len + 3] = '\0';
+    /* done with *a*, which mustn't be rooted: it may have been bumped out
+     * of the region rather than the heaps, see `lregion_alloc` */
+    lval_cleanup(a);
 
     mpc_result_t r;
     if (mpc_parse_contents(filename, Program, &r)) {
         lval *expr = lval_read(r.output);
+        gc_push_root(expr);
 
         while (expr->count) {
             lval *x = lval_eval(e, lval_pop(expr, 0));
-            if (x->type == LVAL_ERR)
+            if (LVAL_TYPE(x) == LVAL_ERR)
                 lval_println(x);
             lval_cleanup(x);
+            gc_maybe_collect(e);
         }
 
+        gc_pop_root();
+
         lval_cleanup(expr);
-        lval_cleanup(a);
         mpc_ast_delete(r.output);
 
         return lval_sexpr();
@@ -430,6 +930,61 @@ builtin_import(lenv *e, lval *a)
 
     lval *err = lval_err("Could not load Library %s", error_msg);
     free(error_msg);
-    lval_cleanup(a);
     return err;
 }
+
+
+void
+lenv_add_builtin(lenv *e, char *symbol, lbuiltin func, char *doc)
+{
+    lval *key = lval_sym(symbol);
+    lval *value = lval_fun(func, doc);
+    lenv_put(e, key, value);
+    lval_cleanup(key);
+    lval_cleanup(value);
+}
+
+
+void
+lenv_add_builtins(lenv *e)
+{
+    lenv_add_builtin(e, "list", builtin_list, "s-expression to q-expression");
+    lenv_add_builtin(e, "head", builtin_head, "first element");
+    lenv_add_builtin(e, "tail", builtin_tail, "list without first element");
+    lenv_add_builtin(e, "eval", builtin_eval, "q-expression to s-expression");
+    lenv_add_builtin(e, "join", builtin_join, "join multiple q-expressions");
+    lenv_add_builtin(e, "vec", builtin_vec, "q-expression to vector");
+    lenv_add_builtin(e, "vec-list", builtin_vec_list, "vector to q-expression");
+    lenv_add_builtin(e, "vec-get", builtin_vec_get, "element at an index");
+    lenv_add_builtin(e, "vec-set", builtin_vec_set, "replace an element");
+    lenv_add_builtin(e, "vec-len", builtin_vec_len, "number of elements");
+    lenv_add_builtin(e, "vec-push", builtin_vec_push, "append to a vector");
+    lenv_add_builtin(e, "def", builtin_def, "assign variable(s) globally");
+    lenv_add_builtin(e, "=", builtin_put, "assign variable(s) locally");
+    lenv_add_builtin(e, "\\", builtin_lambda, "anonymous function");
+
+    lenv_add_builtin(e, "+", builtin_add, "add numbers");
+    lenv_add_builtin(e, "-", builtin_sub, "subtract numbers");
+    lenv_add_builtin(e, "*", builtin_mul, "multiply numbers");
+    lenv_add_builtin(e, "/", builtin_div, "divide numbers");
+
+    lenv_add_builtin(e, "if", builtin_if, "conditional check");
+    lenv_add_builtin(e, "==", builtin_eq, "equals");
+    lenv_add_builtin(e, "!=", builtin_ne, "not equals");
+    lenv_add_builtin(e, ">", builtin_gt, "greater than");
+    lenv_add_builtin(e, "<", builtin_lt, "lesser than");
+    lenv_add_builtin(e, ">=", builtin_ge, "greater than or equal to");
+    lenv_add_builtin(e, "<=", builtin_le, "lesser than or equal to");
+
+    lenv_add_builtin(e, "import", builtin_import, "add file to namespace");
+    lenv_add_builtin(e, "print", builtin_print, "print to stdout");
+    lenv_add_builtin(e, "error", builtin_error, "print error");
+    lenv_add_builtin(
+        e, "alloc-stats", builtin_alloc_stats, "allocator statistics");
+    lenv_add_builtin(e, "gc-stats", builtin_gc_stats, "print gc statistics");
+    lenv_add_builtin(e, "gc-growth", builtin_gc_growth, "set gc heap growth");
+    lenv_add_builtin(e, "max-depth", builtin_max_depth, "set the call depth limit");
+    lenv_add_builtin(
+        e, "cache-stats", builtin_cache_stats, "call site cache statistics");
+    lenv_add_builtin(e, "jit", builtin_jit, "compile hot numeric functions");
+}
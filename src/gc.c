@@ -0,0 +1,275 @@
+/*
+ * gc.c
+ * ----
+ *
+ *   Mark-and-sweep collector for the object heaps in alloc.c.
+ *
+ *   Reference counting frees almost everything the moment it becomes
+ *   unreachable. The collector is the safety net for the rest: whatever
+ *   is still allocated but can't be reached from the global environment
+ *   or the root stack is garbage, however many references it holds.
+ *
+ *   The C stack isn't scanned, so the collector only runs at safe points
+ *   where nothing is being evaluated: between the top level forms of a
+ *   file given on the command line and between REPL inputs. Anything
+ *   live at such a point has to be on the root stack.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "lithp.h"
+
+
+#define GC_MIN_THRESHOLD 100000
+
+
+/* collections are held off while this is non-zero, see `lvm_run` */
+int gc_inhibit = 0;
+
+static lval **roots;
+static uint64_t roots_count;
+static uint64_t roots_size;
+
+static uint64_t threshold = GC_MIN_THRESHOLD;
+static gc_stats stats = {.growth = 200};
+
+
+void
+gc_push_root(lval *v)
+{
+    if (roots_count == roots_size) {
+        roots_size = roots_size ? roots_size * 2 : 16;
+        roots = realloc(roots, sizeof(lval *) * roots_size);
+    }
+    roots[roots_count++] = v;
+}
+
+
+void
+gc_pop_root(void)
+{
+    roots_count--;
+}
+
+
+gc_stats
+gc_get_stats(void)
+{
+    stats.live = lheap_live();
+    stats.threshold = threshold;
+    return stats;
+}
+
+
+/*
+ * Function:  gc_set_growth
+ * ------------------------
+ *   After a collection the next one is due once the heap has grown to
+ *   *percent* percent of what survived.
+ */
+void
+gc_set_growth(uint64_t percent)
+{
+    stats.growth = percent;
+}
+
+
+#ifndef LITHP_MALLOC
+static lval **stack; /* mark stack */
+static uint64_t stack_count;
+static uint64_t stack_size;
+
+
+static void
+push(lval *v)
+{
+    if (LVAL_IS_FIXNUM(v) || lheap_mark(v))
+        return;
+
+    if (stack_count == stack_size) {
+        stack_size = stack_size ? stack_size * 2 : 256;
+        stack = realloc(stack, sizeof(lval *) * stack_size);
+    }
+    stack[stack_count++] = v;
+}
+
+
+/* Parents aren't followed: they are only meaningful during a call. */
+static void
+mark_env(lenv *e)
+{
+    if (lheap_mark(e))
+        return;
+    for (uint64_t i = 0; i < e->count; i++)
+        push(e->vals[i]);
+}
+
+
+static void
+mark(void)
+{
+    while (stack_count) {
+        lval *v = stack[--stack_count];
+
+        switch (v->type) {
+        case LVAL_FUN:
+            if (!v->builtin) {
+                push(v->bound);
+                push(v->formals);
+                push(v->body);
+                push(v->source);
+            }
+            break;
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+        case LVAL_VEC:
+            for (uint64_t i = 0; i < v->count; i++)
+                push(v->cell[i]);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
+
+
+/* Garbage may refer to live objects; give those their references back. */
+static void
+release_live(lval *v)
+{
+    if (!LVAL_IS_FIXNUM(v) && lheap_is_marked(v))
+        v->refs--;
+}
+
+
+static void
+release_lval(void *p)
+{
+    lval *v = p;
+    switch (v->type) {
+    case LVAL_FUN:
+        if (!v->builtin) {
+            release_live(v->bound);
+            release_live(v->formals);
+            release_live(v->body);
+            release_live(v->source);
+        }
+        break;
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+    case LVAL_VEC:
+        for (uint64_t i = 0; i < v->count; i++)
+            release_live(v->cell[i]);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
+static void
+release_lenv(void *p)
+{
+    lenv *e = p;
+    for (uint64_t i = 0; i < e->count; i++)
+        release_live(e->vals[i]);
+}
+
+
+static void
+free_lval(void *p)
+{
+    lval *v = p;
+    switch (v->type) {
+    case LVAL_ERR:
+        free(v->error_msg);
+        break;
+    case LVAL_STR:
+        free(v->str);
+        break;
+    case LVAL_BIG:
+        free(v->limbs);
+        break;
+    case LVAL_FUN:
+        if (!v->builtin)
+            lcode_cleanup(v->code);
+        break;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+    case LVAL_VEC:
+        lfree(v->cell - v->start, sizeof(lval *) * v->capacity);
+        break;
+    default:
+        break;
+    }
+    lheap_free(LHEAP_LVAL, v, lval_size(v));
+    stats.freed++;
+}
+
+
+static void
+free_lenv(void *p)
+{
+    lenv_free(p);
+}
+
+
+static void
+collect(lenv *e)
+{
+    clock_t start = clock();
+
+    while (e->parent)
+        e = e->parent;
+    mark_env(e);
+    for (uint64_t i = 0; i < roots_count; i++)
+        push(roots[i]);
+    mark();
+
+    lheap_each_unmarked(LHEAP_LVAL, release_lval);
+    lheap_each_unmarked(LHEAP_LENV, release_lenv);
+    lheap_each_unmarked(LHEAP_LVAL, free_lval);
+    lheap_each_unmarked(LHEAP_LENV, free_lenv);
+    lheap_unmark();
+
+    uint64_t pause = (clock() - start) * 1000000 / CLOCKS_PER_SEC;
+    stats.collections++;
+    stats.pause_total += pause;
+    stats.pause_last = pause;
+    if (pause > stats.pause_max)
+        stats.pause_max = pause;
+}
+#endif
+
+
+/*
+ * Function:  gc_maybe_collect
+ * ---------------------------
+ *   Safe point. Collect if the heap has outgrown the threshold and no
+ *   evaluation is in progress. *e* is any environment; its top parent
+ *   is used as the root.
+ */
+void
+gc_maybe_collect(lenv *e)
+{
+#ifndef LITHP_MALLOC
+    if (gc_inhibit || lheap_live() < threshold)
+        return;
+
+    collect(e);
+
+    threshold = lheap_live() * stats.growth / 100;
+    if (threshold < GC_MIN_THRESHOLD)
+        threshold = GC_MIN_THRESHOLD;
+#else
+    (void)e;
+#endif
+}
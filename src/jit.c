@@ -0,0 +1,660 @@
+/*
+ * jit.c
+ * -----
+ *
+ *   Template compiler to x86-64 for lisp functions that only do integer
+ *   arithmetic, comparisons, `if` and calls of themselves, like a naive
+ *   fibonacci or the `_pow` loop of examples/ma.th.
+ *
+ *   A function is compiled after `LJIT_THRESHOLD` calls. Every
+ *   expression is translated on its own into code leaving its value in
+ *   rax, with the values waiting for it pushed on the machine stack.
+ *   Calls of the function itself become native calls, or jumps back to
+ *   the start when in tail position.
+ *
+ *   The native code is only entered when all arguments are numbers, and
+ *   the names it uses are bound to the same builtins and function as
+ *   when it was compiled, by nothing but the global environment. Things
+ *   it can't do the way the interpreter would - overflow, division by
+ *   zero, recursion deeper than `LJIT_MAX_DEPTH` - abandon the call, to
+ *   be evaluated again from the start by the interpreter. Nothing these
+ *   functions do is visible outside, so that's the same as if it never
+ *   happened.
+ *
+ *   `(jit 0)` turns it off and `(jit 2)` evaluates every compiled call
+ *   with the interpreter too, failing when the results differ.
+ *
+ */
+
+
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define LJIT_NATIVE
+#endif
+
+#include "lithp.h"
+
+
+#define LJIT_THRESHOLD 100 /* calls before a function is compiled */
+#define LJIT_MAX_DEPTH 10000
+#define LJIT_MAX_BAILS 8   /* abandoned calls before giving up on it */
+#define LJIT_MAX_ARGS 16
+#define LJIT_MAX_NESTING 100
+
+
+/* A name used by compiled code and what it has to be bound to. */
+typedef struct {
+    char *sym;
+    lbuiltin builtin; /* NULL for the function itself */
+} ldep;
+
+struct ljit {
+    lcode *code; /* owns this */
+    uint8_t *mem;
+    size_t size;
+    int (*entry)(const int64_t *args, int64_t *result);
+    uint32_t nargs;
+    uint32_t bails;
+    uint64_t version; /* of the environment when `deps` were checked */
+    uint32_t ndeps;
+    ldep *deps;
+};
+
+
+static int mode = LJIT_ON;
+
+
+void
+ljit_set_mode(int m)
+{
+    mode = m;
+}
+
+
+void
+ljit_free(ljit *j)
+{
+    if (!j)
+        return;
+#ifdef LJIT_NATIVE
+    munmap(j->mem, j->size);
+#endif
+    free(j->deps);
+    free(j);
+}
+
+
+/*****************************************************************************/
+/*                                 COMPILER                                  */
+/*****************************************************************************/
+
+#ifdef LJIT_NATIVE
+
+typedef struct {
+    uint8_t *out;
+    size_t count;
+    size_t size;
+    lval *f;
+    lenv *root;
+    ldep *deps;
+    uint32_t ndeps;
+    uint32_t dsize;
+    size_t bail;  /* abandons the call */
+    size_t inner; /* the function, called with its arguments pushed */
+    size_t body;  /* where tail calls jump to */
+    uint32_t nesting;
+    int failed;
+} ljitc;
+
+
+enum {
+    CC_O = 0x0, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7,
+    CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF,
+};
+
+
+static void
+emit(ljitc *c, const uint8_t *bytes, size_t n)
+{
+    if (c->count + n > c->size) {
+        c->size = c->size ? c->size * 2 : 256;
+        c->out = realloc(c->out, c->size);
+    }
+    memcpy(c->out + c->count, bytes, n);
+    c->count += n;
+}
+
+#define EMIT(c, ...)                                                          \
+    emit(c, (const uint8_t[]){__VA_ARGS__},                                   \
+         sizeof((const uint8_t[]){__VA_ARGS__}))
+
+
+static void
+emit32(ljitc *c, int32_t v)
+{
+    uint8_t b[4];
+    for (int i = 0; i < 4; i++)
+        b[i] = (uint8_t)((uint32_t)v >> (8 * i));
+    emit(c, b, 4);
+}
+
+
+static void
+emit64(ljitc *c, int64_t v)
+{
+    uint8_t b[8];
+    for (int i = 0; i < 8; i++)
+        b[i] = (uint8_t)((uint64_t)v >> (8 * i));
+    emit(c, b, 8);
+}
+
+
+static void
+patch(ljitc *c, size_t at, size_t target)
+{
+    int32_t rel = (int32_t)(target - (at + 4));
+    for (int i = 0; i < 4; i++)
+        c->out[at + i] = (uint8_t)((uint32_t)rel >> (8 * i));
+}
+
+
+/* Jump if *cc* to *target*, or return where to patch it in if 0. */
+static size_t
+jcc(ljitc *c, int cc, size_t target)
+{
+    EMIT(c, 0x0F, (uint8_t)(0x80 | cc));
+    emit32(c, 0);
+    if (target)
+        patch(c, c->count - 4, target);
+    return c->count - 4;
+}
+
+
+static size_t
+jmp(ljitc *c, size_t target)
+{
+    EMIT(c, 0xE9);
+    emit32(c, 0);
+    if (target)
+        patch(c, c->count - 4, target);
+    return c->count - 4;
+}
+
+
+/* Where argument *i* is relative to rbp, see `compile_function`. */
+static int32_t
+slot(ljitc *c, uint64_t i)
+{
+    return (int32_t)(16 + 8 * (c->f->formals->count - 1 - i));
+}
+
+
+static int64_t
+formal(ljitc *c, lval *x)
+{
+    lval *formals = c->f->formals;
+    for (uint64_t i = 0; i < formals->count; i++)
+        if (formals->cell[i]->symbol == x->symbol)
+            return (int64_t)i;
+    return -1;
+}
+
+
+static void
+emit_return(ljitc *c)
+{
+    EMIT(c, 0x48, 0xFF, 0xCB); /* dec rbx */
+    EMIT(c, 0x48, 0x89, 0xEC); /* mov rsp, rbp */
+    EMIT(c, 0x5D);             /* pop rbp */
+    EMIT(c, 0xC3);             /* ret */
+}
+
+
+/* Whether *sym* is globally bound to the function being compiled or a
+ * builtin the compiler knows, which is stored in *b*, NULL for the
+ * function. */
+static int
+resolve(ljitc *c, lval *sym, lbuiltin *b)
+{
+    static const lbuiltin known[] = {
+        builtin_add, builtin_sub, builtin_mul, builtin_div, builtin_eq,
+        builtin_ne,  builtin_gt,  builtin_lt,  builtin_ge,  builtin_le,
+        builtin_if,
+    };
+
+    if (LVAL_TYPE(sym) != LVAL_SYM || formal(c, sym) >= 0)
+        return 0;
+    int64_t i = lenv_find(c->root, sym->symbol);
+    if (i < 0)
+        return 0;
+    lval *v = c->root->vals[i];
+
+    *b = NULL;
+    if (v != c->f) {
+        if (LVAL_TYPE(v) != LVAL_FUN)
+            return 0;
+        for (size_t k = 0; k < sizeof(known) / sizeof(*known); k++)
+            if (v->builtin == known[k])
+                *b = known[k];
+        if (!*b)
+            return 0;
+    }
+
+    for (uint32_t k = 0; k < c->ndeps; k++)
+        if (c->deps[k].sym == sym->symbol)
+            return 1;
+    if (c->ndeps == c->dsize) {
+        c->dsize = c->dsize ? c->dsize * 2 : 8;
+        c->deps = realloc(c->deps, sizeof(ldep) * c->dsize);
+    }
+    c->deps[c->ndeps++] = (ldep){sym->symbol, *b};
+    return 1;
+}
+
+
+static void
+compile_list(ljitc *, lval *, int tail);
+
+
+static void
+compile(ljitc *c, lval *x, int tail)
+{
+    switch (LVAL_TYPE(x)) {
+    case LVAL_NUM:
+        EMIT(c, 0x48, 0xB8); /* mov rax, imm64 */
+        emit64(c, LVAL_NUMBER(x));
+        break;
+
+    case LVAL_SYM: {
+        int64_t i = formal(c, x);
+        if (i < 0) {
+            c->failed = 1;
+            return;
+        }
+        EMIT(c, 0x48, 0x8B, 0x85); /* mov rax, [rbp + slot] */
+        emit32(c, slot(c, (uint64_t)i));
+        break;
+    }
+
+    case LVAL_SEXPR:
+        compile_list(c, x, tail);
+        return;
+
+    default:
+        c->failed = 1;
+        return;
+    }
+
+    if (tail)
+        emit_return(c);
+}
+
+
+static void
+compile_arith(ljitc *c, lval *x, lbuiltin b)
+{
+    compile(c, x->cell[1], 0);
+    if (x->count == 2 && b == builtin_sub) {
+        EMIT(c, 0x48, 0xF7, 0xD8); /* neg rax */
+        jcc(c, CC_O, c->bail);
+        return;
+    }
+
+    for (uint64_t i = 2; i < x->count; i++) {
+        EMIT(c, 0x50); /* push rax */
+        compile(c, x->cell[i], 0);
+        EMIT(c, 0x48, 0x89, 0xC1); /* mov rcx, rax */
+        EMIT(c, 0x58);             /* pop rax */
+
+        if (b == builtin_add) {
+            EMIT(c, 0x48, 0x01, 0xC8); /* add rax, rcx */
+            jcc(c, CC_O, c->bail);
+        } else if (b == builtin_sub) {
+            EMIT(c, 0x48, 0x29, 0xC8); /* sub rax, rcx */
+            jcc(c, CC_O, c->bail);
+        } else if (b == builtin_mul) {
+            EMIT(c, 0x48, 0x0F, 0xAF, 0xC1); /* imul rax, rcx */
+            jcc(c, CC_O, c->bail);
+        } else {
+            EMIT(c, 0x48, 0x85, 0xC9); /* test rcx, rcx */
+            jcc(c, CC_E, c->bail);
+            EMIT(c, 0x48, 0x83, 0xF9, 0xFF); /* cmp rcx, -1 */
+            size_t fine = jcc(c, CC_NE, 0);
+            EMIT(c, 0x48, 0xBA); /* mov rdx, INTMAX_MIN */
+            emit64(c, INT64_MIN);
+            EMIT(c, 0x48, 0x39, 0xD0); /* cmp rax, rdx */
+            jcc(c, CC_E, c->bail);
+            patch(c, fine, c->count);
+            EMIT(c, 0x48, 0x99);       /* cqo */
+            EMIT(c, 0x48, 0xF7, 0xF9); /* idiv rcx */
+        }
+    }
+}
+
+
+static void
+compile_compare(ljitc *c, lval *x, lbuiltin b)
+{
+    int cc = b == builtin_eq   ? CC_E
+             : b == builtin_ne ? CC_NE
+             : b == builtin_gt ? CC_G
+             : b == builtin_lt ? CC_L
+             : b == builtin_ge ? CC_GE
+                               : CC_LE;
+
+    compile(c, x->cell[1], 0);
+    EMIT(c, 0x50); /* push rax */
+    compile(c, x->cell[2], 0);
+    EMIT(c, 0x48, 0x89, 0xC1);                 /* mov rcx, rax */
+    EMIT(c, 0x58);                             /* pop rax */
+    EMIT(c, 0x48, 0x39, 0xC8);                 /* cmp rax, rcx */
+    EMIT(c, 0x0F, (uint8_t)(0x90 | cc), 0xC0); /* setcc al */
+    EMIT(c, 0x0F, 0xB6, 0xC0);                 /* movzx eax, al */
+}
+
+
+static void
+compile_if(ljitc *c, lval *x, int tail)
+{
+    compile(c, x->cell[1], 0);
+    EMIT(c, 0x48, 0x85, 0xC0); /* test rax, rax */
+    size_t otherwise = jcc(c, CC_E, 0);
+    compile_list(c, x->cell[2], tail);
+
+    size_t end = tail ? 0 : jmp(c, 0);
+    patch(c, otherwise, c->count);
+    compile_list(c, x->cell[3], tail);
+    if (!tail)
+        patch(c, end, c->count);
+}
+
+
+static void
+compile_self(ljitc *c, lval *x, int tail)
+{
+    uint64_t n = x->count - 1;
+    for (uint64_t i = 1; i < x->count; i++) {
+        compile(c, x->cell[i], 0);
+        EMIT(c, 0x50); /* push rax */
+    }
+
+    if (tail) {
+        for (uint64_t i = n; i-- > 0;) {
+            EMIT(c, 0x58);             /* pop rax */
+            EMIT(c, 0x48, 0x89, 0x85); /* mov [rbp + slot], rax */
+            emit32(c, slot(c, i));
+        }
+        jmp(c, c->body);
+        return;
+    }
+
+    EMIT(c, 0xE8); /* call inner */
+    emit32(c, 0);
+    patch(c, c->count - 4, c->inner);
+    EMIT(c, 0x48, 0x81, 0xC4); /* add rsp, imm32 */
+    emit32(c, (int32_t)(8 * n));
+}
+
+
+/* Compile the cells of *x* evaluated as an s-expression. */
+static void
+compile_list(ljitc *c, lval *x, int tail)
+{
+    if (c->failed || x->count == 0 || c->nesting >= LJIT_MAX_NESTING) {
+        c->failed = 1;
+        return;
+    }
+    if (x->count == 1) {
+        compile(c, x->cell[0], tail);
+        return;
+    }
+
+    lbuiltin b;
+    if (!resolve(c, x->cell[0], &b)) {
+        c->failed = 1;
+        return;
+    }
+
+    c->nesting++;
+    if (!b) {
+        if (x->count - 1 != c->f->formals->count)
+            c->failed = 1;
+        else
+            compile_self(c, x, tail);
+    } else if (b == builtin_if) {
+        if (x->count != 4 || LVAL_TYPE(x->cell[2]) != LVAL_QEXPR ||
+            LVAL_TYPE(x->cell[3]) != LVAL_QEXPR)
+            c->failed = 1;
+        else
+            compile_if(c, x, tail);
+    } else if (b == builtin_add || b == builtin_sub || b == builtin_mul ||
+               b == builtin_div) {
+        compile_arith(c, x, b);
+        if (tail)
+            emit_return(c);
+    } else {
+        if (x->count != 3)
+            c->failed = 1;
+        else
+            compile_compare(c, x, b);
+        if (tail)
+            emit_return(c);
+    }
+    c->nesting--;
+}
+
+
+/*
+ * Function:  compile_function
+ * ---------------------------
+ *   Translate the lisp function *f*, defined in *root*, to a native
+ *   function taking its arguments as an array and storing its result,
+ *   returning 0 if the call was abandoned. Return NULL if it can't be.
+ *
+ *   The code starts with the entry, which saves the registers it uses,
+ *   pushes the arguments and calls the inner function. rbx counts how
+ *   deep that recursed and r12 is the stack to go back to when bailing
+ *   out. The inner function finds argument *i* at rbp + `slot(i)`.
+ */
+static ljit *
+compile_function(lval *f, lenv *root)
+{
+    lval *formals = f->formals;
+    if (formals->count == 0 || formals->count > LJIT_MAX_ARGS)
+        return NULL;
+    for (uint64_t i = 0; i < formals->count; i++)
+        if (formals->cell[i]->symbol == lsym_intern(":"))
+            return NULL;
+
+    ljitc c = {.f = f, .root = root};
+
+    EMIT(&c, 0x55);             /* push rbp */
+    EMIT(&c, 0x48, 0x89, 0xE5); /* mov rbp, rsp */
+    EMIT(&c, 0x53);             /* push rbx */
+    EMIT(&c, 0x41, 0x54);       /* push r12 */
+    EMIT(&c, 0x41, 0x55);       /* push r13 */
+    EMIT(&c, 0x49, 0x89, 0xE4); /* mov r12, rsp */
+    EMIT(&c, 0x49, 0x89, 0xF5); /* mov r13, rsi */
+    EMIT(&c, 0x31, 0xDB);       /* xor ebx, ebx */
+    for (uint64_t i = 0; i < formals->count; i++) {
+        EMIT(&c, 0xFF, 0xB7); /* push qword [rdi + 8i] */
+        emit32(&c, (int32_t)(8 * i));
+    }
+    EMIT(&c, 0xE8); /* call inner */
+    emit32(&c, 0);
+    size_t call = c.count - 4;
+    EMIT(&c, 0x49, 0x89, 0x45, 0x00);       /* mov [r13], rax */
+    EMIT(&c, 0xB8, 0x01, 0x00, 0x00, 0x00); /* mov eax, 1 */
+    EMIT(&c, 0xEB, 0x02);                   /* jmp done */
+    c.bail = c.count;
+    EMIT(&c, 0x31, 0xC0);       /* xor eax, eax */
+    EMIT(&c, 0x4C, 0x89, 0xE4); /* done: mov rsp, r12 */
+    EMIT(&c, 0x41, 0x5D);       /* pop r13 */
+    EMIT(&c, 0x41, 0x5C);       /* pop r12 */
+    EMIT(&c, 0x5B);             /* pop rbx */
+    EMIT(&c, 0x5D);             /* pop rbp */
+    EMIT(&c, 0xC3);             /* ret */
+
+    c.inner = c.count;
+    patch(&c, call, c.inner);
+    EMIT(&c, 0x55);             /* push rbp */
+    EMIT(&c, 0x48, 0x89, 0xE5); /* mov rbp, rsp */
+    EMIT(&c, 0x48, 0xFF, 0xC3); /* inc rbx */
+    EMIT(&c, 0x48, 0x81, 0xFB); /* cmp rbx, LJIT_MAX_DEPTH */
+    emit32(&c, LJIT_MAX_DEPTH);
+    jcc(&c, CC_A, c.bail);
+    c.body = c.count;
+    compile_list(&c, f->source, 1);
+
+    if (c.failed) {
+        free(c.out);
+        free(c.deps);
+        return NULL;
+    }
+
+    size_t size = c.count;
+    uint8_t *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        free(c.out);
+        free(c.deps);
+        return NULL;
+    }
+    memcpy(mem, c.out, size);
+    free(c.out);
+    if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        /* not allowed to execute it, e.g. under W^X, interpret instead */
+        munmap(mem, size);
+        free(c.deps);
+        return NULL;
+    }
+
+    ljit *j = calloc(1, sizeof(ljit));
+    j->code = f->code;
+    j->mem = mem;
+    j->size = size;
+    *(void **)&j->entry = mem;
+    j->nargs = (uint32_t)formals->count;
+    j->version = lenv_get_version();
+    j->ndeps = c.ndeps;
+    j->deps = c.deps;
+    return j;
+}
+
+#else
+
+static ljit *
+compile_function(lval *f, lenv *root)
+{
+    (void)f;
+    (void)root;
+    return NULL;
+}
+
+#endif
+
+
+/*****************************************************************************/
+/*                                   CALLS                                   */
+/*****************************************************************************/
+
+/* Whether the names used by *j* still mean what they did. */
+static int
+guard(ljit *j, lenv *root)
+{
+    for (uint32_t i = 0; i < j->ndeps; i++)
+        if (LSYM(j->deps[i].sym)->bindings != 1)
+            return 0;
+    if (j->version == lenv_get_version())
+        return 1;
+
+    for (uint32_t i = 0; i < j->ndeps; i++) {
+        int64_t k = lenv_find(root, j->deps[i].sym);
+        if (k < 0)
+            return 0;
+        lval *v = root->vals[k];
+        if (LVAL_TYPE(v) != LVAL_FUN || v->builtin != j->deps[i].builtin)
+            return 0;
+        if (!v->builtin && (v->code != j->code || v->bound->count))
+            return 0;
+    }
+    j->version = lenv_get_version();
+    return 1;
+}
+
+
+/* Evaluate the call of *f* again without compiled code and make sure the
+ * result *x* is the same. */
+static lval *
+verify(lenv *e, lval *f, lval **args, uint32_t count, lval *x)
+{
+    lval *a = lval_sexpr();
+    for (uint32_t i = 0; i < count; i++)
+        a = lval_add(a, lval_copy(args[i]));
+
+    mode = LJIT_OFF;
+    lval *y = lval_call(e, f, a);
+    mode = LJIT_VERIFY;
+
+    if (!lval_eq(x, y)) {
+        lval_cleanup(y);
+        y = lval_err(
+            "Compiled code returned %li, the interpreter something else!",
+            LVAL_NUMBER(x));
+    }
+    lval_cleanup(x);
+    return y;
+}
+
+
+/*
+ * Function:  ljit_call
+ * --------------------
+ *   Call the lisp function *f* with *count* arguments *args* in the
+ *   environment *e* using native code, compiling it when it's due. Return
+ *   NULL if the call has to be evaluated the usual way instead. *args*
+ *   are borrowed and have to be kept on the VM stack, see `lvm_run`.
+ */
+lval *
+ljit_call(lenv *e, lval *f, lval **args, uint32_t count)
+{
+    if (mode == LJIT_OFF || f->bound->count)
+        return NULL;
+
+    lcode *code = f->code;
+    if (!code->jit) {
+        if (code->hot > LJIT_THRESHOLD || ++code->hot <= LJIT_THRESHOLD)
+            return NULL;
+        code->jit = compile_function(f, e->root);
+        if (!code->jit)
+            return NULL;
+    }
+
+    ljit *j = code->jit;
+    if (count != j->nargs || j->bails >= LJIT_MAX_BAILS ||
+        !guard(j, e->root))
+        return NULL;
+
+    int64_t v[LJIT_MAX_ARGS];
+    for (uint32_t i = 0; i < count; i++) {
+        if (LVAL_TYPE(args[i]) != LVAL_NUM)
+            return NULL;
+        v[i] = LVAL_NUMBER(args[i]);
+    }
+
+    int64_t r;
+    if (!j->entry(v, &r)) {
+        j->bails++;
+        return NULL;
+    }
+
+    lval *x = lval_num(r);
+    return mode == LJIT_VERIFY ? verify(e, f, args, count, x) : x;
+}
@@ -7,6 +7,7 @@
  */
 
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,21 +15,77 @@
 #include "lithp.h"
 
 
+/* Frames with more bindings than this get a hash index, see `lenv_find`.
+ * Lambda frames stay below it and are searched linearly. */
+#define LENV_HASH_MIN 16
+
+
+/* Bumped whenever a binding changes its value, see `lenv_get_cached` */
+static uint64_t version = 1;
+static lcache_stats cache_stats;
+
+
+static uint64_t
+sym_slot(char *sym, uint64_t size)
+{
+    /* interned names are unique pointers, so hashing the address will do */
+    return ((uintptr_t)sym * 11400714819323198485u >> 32) & (size - 1);
+}
+
+
+static void
+index_insert(lenv *e, uint64_t i)
+{
+    uint64_t slot = sym_slot(e->syms[i], e->index_size);
+    while (e->index[slot])
+        slot = (slot + 1) & (e->index_size - 1);
+    e->index[slot] = i + 1;
+}
+
+
+/*
+ * Function:  lenv_reindex
+ * -----------------------
+ *   (Re)build the hash index of *e*, an open-addressing table of
+ *   positions in `syms` kept at most half full.
+ */
+static void
+lenv_reindex(lenv *e)
+{
+    lfree(e->index, sizeof(uint64_t) * e->index_size);
+
+    e->index_size = 64;
+    while (e->index_size < e->capacity * 2)
+        e->index_size *= 2;
+    e->index = lalloc(sizeof(uint64_t) * e->index_size);
+    memset(e->index, 0, sizeof(uint64_t) * e->index_size);
+
+    for (uint64_t i = 0; i < e->count; i++)
+        index_insert(e, i);
+}
+
+
 lenv *
 lenv_copy(lenv *e)
 {
-    lenv *n = malloc(sizeof(lenv));
+    lenv *n = lheap_alloc(LHEAP_LENV, sizeof(lenv));
     n->parent = e->parent;
+    n->root = e->parent ? e->root : n;
     n->count = e->count;
-    n->syms = malloc(sizeof(char *) * n->count);
-    n->vals = malloc(sizeof(lval *) * n->count);
+    n->capacity = e->count;
+    n->syms = lalloc(sizeof(char *) * n->capacity);
+    n->vals = lalloc(sizeof(lval *) * n->capacity);
+    n->index = NULL;
+    n->index_size = 0;
 
     for (uint64_t i = 0; i < n->count; i++) {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
+        n->syms[i] = e->syms[i];
         n->vals[i] = lval_copy(e->vals[i]);
+        LSYM(n->syms[i])->bindings++;
     }
 
+    if (n->count > LENV_HASH_MIN)
+        lenv_reindex(n);
     return n;
 }
 
@@ -36,39 +93,171 @@ lenv_copy(lenv *e)
 lenv *
 lenv_new(void)
 {
-    lenv *e = malloc(sizeof(lenv));
+    lenv *e = lheap_alloc(LHEAP_LENV, sizeof(lenv));
     e->parent = NULL;
+    e->root = e;
     e->count = 0;
+    e->capacity = 0;
     e->syms = NULL;
     e->vals = NULL;
+    e->index = NULL;
+    e->index_size = 0;
     return e;
 }
 
 
+/*
+ * Function:  lenv_free
+ * --------------------
+ *   Free *e* itself, leaving the values bound in it alone.
+ */
+void
+lenv_free(lenv *e)
+{
+    for (uint64_t i = 0; i < e->count; i++)
+        LSYM(e->syms[i])->bindings--;
+    lfree(e->syms, sizeof(char *) * e->capacity);
+    lfree(e->vals, sizeof(lval *) * e->capacity);
+    lfree(e->index, sizeof(uint64_t) * e->index_size);
+    lheap_free(LHEAP_LENV, e, sizeof(lenv));
+}
+
+
 void
 lenv_clean_up(lenv *e)
 {
-    for (uint64_t i = 0; i < e->count; i++) {
-        free(e->syms[i]);
+    for (uint64_t i = 0; i < e->count; i++)
         lval_cleanup(e->vals[i]);
+    lenv_free(e);
+}
+
+
+/*
+ * Function:  lenv_find
+ * --------------------
+ *   Return the position of the interned name *sym* in *e* (ignoring
+ *   parents), or -1 if it isn't bound there.
+ */
+int64_t
+lenv_find(lenv *e, char *sym)
+{
+    if (!e->index) {
+        for (uint64_t i = 0; i < e->count; i++)
+            if (e->syms[i] == sym)
+                return i;
+        return -1;
+    }
+
+    uint64_t slot = sym_slot(sym, e->index_size);
+    while (e->index[slot]) {
+        uint64_t i = e->index[slot] - 1;
+        if (e->syms[i] == sym)
+            return i;
+        slot = (slot + 1) & (e->index_size - 1);
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    return -1;
 }
 
 
+/* Whether everything bound in *old* is bound in *n* as well, so that a
+ * lookup through *n* can never reach *old*. */
+int
+lenv_shadows(lenv *n, lenv *old)
+{
+    for (uint64_t i = 0; i < old->count; i++)
+        if (lenv_find(n, old->syms[i]) < 0)
+            return 0;
+    return 1;
+}
+
+
+/*
+ * Function:  lenv_get
+ * -------------------
+ *   Look up the symbol *k*. Each symbol remembers where it was found
+ *   last time, which is tried before searching:
+ *
+ *   `slot` is a position in the innermost frame. If that holds the same
+ *   name, it is the binding a search would find first.
+ *
+ *   `global_slot` is a position in the top environment. It can only be
+ *   trusted when no other environment binds the name, otherwise a frame
+ *   in between might shadow it.
+ */
 lval *
 lenv_get(lenv *e, lval *k)
 {
-    for (uint64_t i = 0; i < e->count; i++)
-        if (strcmp(e->syms[i], k->symbol) == 0)
-            return lval_copy(e->vals[i]);
+    char *sym = k->symbol;
+
+    if (k->slot < e->count && e->syms[k->slot] == sym)
+        return lval_copy(e->vals[k->slot]);
+
+    lenv *root = e->root;
+    if (LSYM(sym)->bindings == 1 && k->global_slot < root->count &&
+        root->syms[k->global_slot] == sym)
+        return lval_copy(root->vals[k->global_slot]);
+
+    for (lenv *f = e; f; f = f->parent) {
+        int64_t i = lenv_find(f, sym);
+        if (i < 0)
+            continue;
+
+        if (f == e)
+            k->slot = i;
+        else if (f == root)
+            k->global_slot = i;
+        return lval_copy(f->vals[i]);
+    }
+
+    return lval_err("Unbound symbol '%s'!", sym);
+}
+
+
+/*
+ * Function:  lenv_get_cached
+ * --------------------------
+ *   Look up the symbol of the call site *c*. A global binding found
+ *   there is remembered and returned without searching for as long as
+ *   no binding anywhere has changed its value and nothing else binds
+ *   the name, so no frame can shadow it.
+ */
+lval *
+lenv_get_cached(lenv *e, lcache *c)
+{
+    char *sym = c->sym->symbol;
+
+    if (c->version == version && c->root == e->root &&
+        LSYM(sym)->bindings == 1) {
+        cache_stats.hits++;
+        return lval_copy(c->value);
+    }
+
+    cache_stats.misses++;
+    lval *v = lenv_get(e, c->sym);
+    if (LSYM(sym)->bindings == 1) {
+        int64_t i = lenv_find(e->root, sym);
+        if (i >= 0) {
+            c->value = e->root->vals[i];
+            c->root = e->root;
+            c->version = version;
+        }
+    }
+    return v;
+}
 
-    if (e->parent)
-        return lenv_get(e->parent, k);
 
-    return lval_err("Unbound symbol '%s'!", k->symbol);
+lcache_stats
+lenv_get_cache_stats(void)
+{
+    return cache_stats;
+}
+
+
+/* Changes whenever a binding anywhere changes its value. */
+uint64_t
+lenv_get_version(void)
+{
+    return version;
 }
 
 
@@ -76,21 +265,32 @@ void
 lenv_put(lenv *e, lval *k, lval *v)
 {
     /* update existing value */
-    for (uint64_t i = 0; i < e->count; i++) {
-        if (strcmp(e->syms[i], k->symbol) == 0) {
-            lval_cleanup(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    int64_t i = lenv_find(e, k->symbol);
+    if (i >= 0) {
+        lval_cleanup(e->vals[i]);
+        e->vals[i] = lval_copy(v);
+        version++;
+        return;
     }
 
-    e->count++;
-    e->syms = realloc(e->syms, sizeof(char *) * e->count);
-    e->vals = realloc(e->vals, sizeof(lval *) * e->count);
+    if (e->count == e->capacity) {
+        uint64_t capacity = e->capacity ? e->capacity * 2 : 4;
+        e->syms = lrealloc(
+            e->syms, sizeof(char *) * e->capacity, sizeof(char *) * capacity);
+        e->vals = lrealloc(
+            e->vals, sizeof(lval *) * e->capacity, sizeof(lval *) * capacity);
+        e->capacity = capacity;
+
+        if (e->index || e->count >= LENV_HASH_MIN)
+            lenv_reindex(e);
+    }
 
-    e->syms[e->count - 1] = malloc(strlen(k->symbol) + 1);
-    strcpy(e->syms[e->count - 1], k->symbol);
-    e->vals[e->count - 1] = lval_copy(v);
+    e->syms[e->count] = k->symbol;
+    e->vals[e->count] = lval_copy(v);
+    LSYM(k->symbol)->bindings++;
+    if (e->index)
+        index_insert(e, e->count);
+    e->count++;
 }
 
 
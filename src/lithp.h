@@ -3,6 +3,8 @@
 
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+typedef struct ljit ljit;
 
 /* function pointer */
 typedef lval *(*lbuiltin)(lenv *, lval *);
@@ -11,11 +13,14 @@ typedef lval *(*lbuiltin)(lenv *, lval *);
 typedef enum {
     LVAL_ERR,
     LVAL_NUM,
+    LVAL_FLOAT,
+    LVAL_BIG,
     LVAL_SYM,
     LVAL_STR,
     LVAL_FUN,
     LVAL_SEXPR,
     LVAL_QEXPR,
+    LVAL_VEC,
 } lval_type;
 
 
@@ -27,74 +32,327 @@ typedef enum {
 */
 struct lval {
     lval_type type;
+    uint32_t refs; /* see `lval_copy` and `lval_unshare` */
 
-    /* could we use a union here? */
-    intmax_t number;
-    char *error_msg;
-    char *symbol;
-    char *str;
+    /* Only the member(s) used by `type` are allocated, see `LVAL_SIZE`. */
+    union {
+        intmax_t number; /* boxed, see fixnums below */
+        double fnumber;
+        char *error_msg;
+        char *str;
 
-    /* builtin function */
-    lbuiltin builtin; /* NULL if user defined */
-    char *docstring;
+        /* integer not fitting `number`, see big.c */
+        struct {
+            uint32_t *limbs; /* least significant first */
+            uint32_t nlimbs;
+            uint32_t negative;
+        };
 
-    /* user function */
-    // TODO: should get docstrings too!
-    lenv *env;
-    lval *formals;
-    lval *body;
+        /* symbol */
+        struct {
+            char *symbol; /* interned */
 
-    /* expression */
-    uint64_t count;
-    lval **cell;
+            /* where this occurrence was bound last time, see `lenv_get` */
+            uint32_t slot;
+            uint32_t global_slot;
+        };
+
+        /* function */
+        struct {
+            lbuiltin builtin; /* NULL if user defined */
+            union {
+                char *docstring;
+
+                /* user function */
+                // TODO: should get docstrings too!
+                struct {
+                    /* arguments given by partial applications so far,
+                     * a q-expression; the first formals are theirs */
+                    lval *bound;
+                    lval *formals;
+                    lval *body;
+                    lval *source; /* `body`, or a rewrite of it, see opt.c */
+                    lcode *code;  /* `source` compiled, see vm.c */
+                };
+            };
+        };
+
+        /* expression */
+        struct {
+            uint64_t count;
+            lval **cell;
+
+            /* `cell` points `start` entries into an array of `capacity`,
+             * so popping the front and appending are amortized O(1) */
+            uint32_t start;
+            uint32_t capacity;
+        };
+    };
 };
 
 
+/* Number of bytes an `lval` needs when *member* is the last one in use. */
+#define LVAL_SIZE(member)                                                      \
+    (offsetof(lval, member) + sizeof(((lval *)0)->member))
+
+
+/* Fixnums
+ * -------
+ *   Numbers that fit in a pointer minus one bit are never allocated.
+ *   They are stored shifted left by one directly in the `lval *`, with
+ *   the lowest bit set; heap values are always aligned, so that bit is
+ *   free. Bigger numbers fall back to a boxed `LVAL_NUM`.
+ *
+ *   Any `lval *` that might be a number must be inspected through
+ *   `LVAL_TYPE` and `LVAL_NUMBER` rather than `->type` and `->number`.
+ */
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+
+#define LVAL_IS_FIXNUM(v) (((uintptr_t)(v)) & 1)
+#define LVAL_TYPE(v) (LVAL_IS_FIXNUM(v) ? LVAL_NUM : (v)->type)
+#define LVAL_NUMBER(v)                                                         \
+    (LVAL_IS_FIXNUM(v) ? (intmax_t)((intptr_t)(v) >> 1) : (v)->number)
+
+
 struct lenv {
     lenv *parent; /* top parent is NULL */
+    lenv *root;   /* top parent, or the environment itself */
     uint64_t count;
-    char **syms;
+    uint64_t capacity;
+    char **syms; /* interned */
     lval **vals;
+
+    /* hash index into `syms`, only for big environments */
+    uint64_t *index;
+    uint64_t index_size;
 };
 
 
+/* ALLOC */
+typedef struct {
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t hits;  /* served from a free list */
+    uint64_t slabs; /* slabs requested from libc */
+    uint64_t large;  /* passed on to malloc */
+    uint64_t region; /* bumped out of the region instead */
+} lalloc_stats;
+
+void *
+lalloc(size_t);
+void *
+lrealloc(void *, size_t old, size_t new);
+void
+lfree(void *, size_t);
+lalloc_stats
+lalloc_get_stats(void);
+void *
+lregion_alloc(size_t);
+size_t
+lregion_mark(void);
+void
+lregion_reset(size_t mark);
+
+typedef enum {
+    LHEAP_LVAL,
+    LHEAP_LENV,
+    LHEAP_KINDS,
+} lheap_kind;
+
+void *
+lheap_alloc(lheap_kind, size_t);
+void
+lheap_free(lheap_kind, void *, size_t);
+uint64_t
+lheap_live(void);
+int
+lheap_mark(void *);
+int
+lheap_is_marked(void *);
+void
+lheap_each_unmarked(lheap_kind, void (*)(void *));
+void
+lheap_unmark(void);
+
+
+/* GC */
+typedef struct {
+    uint64_t collections;
+    uint64_t freed;       /* objects reclaimed by the collector */
+    uint64_t pause_total; /* microseconds */
+    uint64_t pause_max;
+    uint64_t pause_last;
+    uint64_t live; /* objects on the heap */
+    uint64_t threshold;
+    uint64_t growth; /* percent */
+} gc_stats;
+
+extern int gc_inhibit;
+
+void
+gc_push_root(lval *);
+void
+gc_pop_root(void);
+void
+gc_maybe_collect(lenv *);
+gc_stats
+gc_get_stats(void);
+void
+gc_set_growth(uint64_t percent);
+
+
+/* VM */
+
+/* What a call site found when it last looked up its function, see
+ * `lenv_get_cached`. */
+typedef struct {
+    lval *sym;
+    lval *value; /* borrowed from `root` */
+    lenv *root;
+    uint64_t version;
+} lcache;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+} lcache_stats;
+
+/* Bytecode for the body of a lisp function. Shared by the partial
+ * applications of that function. The constants belong to what was
+ * compiled, the function's `source`. */
+struct lcode {
+    uint32_t refs;
+    uint32_t count; /* instructions */
+    uint32_t *ops;
+    uint32_t nconsts;
+    lval **consts;
+    uint32_t ncaches; /* one for each call site naming its function */
+    lcache *caches;
+    uint32_t max_stack;
+    uint32_t hot; /* calls counted towards compiling it, see jit.c */
+    ljit *jit;
+};
+
+lcode *
+lcode_compile(lval *body);
+lcode *
+lcode_copy(lcode *);
+void
+lcode_cleanup(lcode *);
+lval *
+lvm_run(lenv *, lenv *outer, lval *owner, lcode *);
+void
+lvm_set_max_depth(uint64_t);
+
+
+/* JIT */
+enum { LJIT_OFF, LJIT_ON, LJIT_VERIFY };
+
+void
+ljit_set_mode(int);
+lval *
+ljit_call(lenv *, lval *f, lval **args, uint32_t count);
+void
+ljit_free(ljit *);
+
+
+/* BIG */
+lval *
+lbig_add(lval *, lval *);
+lval *
+lbig_sub(lval *, lval *);
+lval *
+lbig_mul(lval *, lval *);
+lval *
+lbig_div(lval *, lval *);
+int
+lbig_cmp(lval *, lval *);
+double
+lbig_to_double(lval *);
+int
+lbig_eq_float(lval *, double);
+lval *
+lbig_read(char *);
+char *
+lbig_to_str(lval *);
+
+
+/* OPT */
+void
+lopt_enable(int);
+lval *
+lopt_body(lenv *, lval *formals, lval *body);
+
+
+/* SYMBOL */
+
+/* Interned names are preceded by the number of environments that
+ * currently bind them. */
+typedef struct {
+    uint64_t bindings;
+    char name[];
+} lsym;
+
+#define LSYM(s) ((lsym *)((s)-offsetof(lsym, name)))
+
+char *
+lsym_intern(char *);
+uint64_t
+lsym_hash(char *);
+
+
 /* LVAL */
 lval *
 lval_err(char *fmt, ...);
 lval *lval_num(intmax_t);
 lval *
+lval_float(double);
+lval *
 lval_sym(char *);
 lval *
 lval_str(char *);
 lval *
 lval_fun(lbuiltin func, char *doc);
 lval *
-lval_lambda(lval *formals, lval *body);
+lval_lambda(lenv *, lval *formals, lval *body);
 lval *
 lval_sexpr(void);
 lval *
 lval_qexpr(void);
+lval *
+lval_vec(void);
 
 void
 lval_cleanup(lval *);
 int
 lval_eq(lval *, lval *);
+int
+lval_contains(lval *, lval *);
 lval *
 lval_copy(lval *);
 lval *
+lval_unshare(lval *);
+lval *
+lval_vec_copy(lval *);
+size_t
+lval_size(lval *);
+lval *
 lval_pop(lval *, uint64_t);
 lval *
 lval_add(lval *, lval *);
 lval *
+lval_push(lval *, lval *);
+lval *
 lval_join(lval *, lval *);
 lval *
+lval_bind(lval *f, lval **args, uint64_t count, lenv **frame);
+lval *
 lval_call(lenv *, lval *, lval *);
 lval *
 lval_take(lval *, uint64_t);
 lval *
 lval_eval(lenv *, lval *);
-lval *
-lval_eval_sexpr(lenv *, lval *);
 
 void
 lval_print(lval *);
@@ -113,13 +371,29 @@ lval_read(mpc_ast_t *);
 lenv *
 lenv_new(void);
 void
+lenv_add_builtin(lenv *, char *symbol, lbuiltin, char *doc);
+void
+lenv_add_builtins(lenv *);
+void
 lenv_put(lenv *, lval *, lval *);
 void
 lenv_put_global(lenv *, lval *, lval *);
 lval *
 lenv_get(lenv *, lval *);
+lval *
+lenv_get_cached(lenv *, lcache *);
+lcache_stats
+lenv_get_cache_stats(void);
+uint64_t
+lenv_get_version(void);
 void
 lenv_clean_up(lenv *);
+void
+lenv_free(lenv *);
+int64_t
+lenv_find(lenv *, char *);
+int
+lenv_shadows(lenv *, lenv *);
 lenv *
 lenv_copy(lenv *);
 
@@ -134,8 +408,22 @@ builtin_tail(lenv *, lval *);
 lval *
 builtin_eval(lenv *, lval *);
 lval *
+builtin_eval_tail(lval *);
+lval *
 builtin_join(lenv *, lval *);
 lval *
+builtin_vec(lenv *, lval *);
+lval *
+builtin_vec_list(lenv *, lval *);
+lval *
+builtin_vec_get(lenv *, lval *);
+lval *
+builtin_vec_set(lenv *, lval *);
+lval *
+builtin_vec_len(lenv *, lval *);
+lval *
+builtin_vec_push(lenv *, lval *);
+lval *
 builtin_def(lenv *, lval *);
 lval *
 builtin_lambda(lenv *, lval *);
@@ -154,6 +442,8 @@ builtin_div(lenv *, lval *);
 lval *
 builtin_if(lenv *, lval *);
 lval *
+builtin_if_tail(lval *);
+lval *
 builtin_eq(lenv *, lval *);
 lval *
 builtin_ne(lenv *, lval *);
@@ -172,14 +462,33 @@ lval *
 builtin_print(lenv *, lval *);
 lval *
 builtin_error(lenv *, lval *);
+lval *
+builtin_alloc_stats(lenv *, lval *);
+lval *
+builtin_gc_stats(lenv *, lval *);
+lval *
+builtin_gc_growth(lenv *, lval *);
+lval *
+builtin_max_depth(lenv *, lval *);
+lval *
+builtin_cache_stats(lenv *, lval *);
+lval *
+builtin_jit(lenv *, lval *);
 
 
-/* PARSER */
-mpc_parser_t *Number;
-mpc_parser_t *String;
-mpc_parser_t *Comment;
-mpc_parser_t *Symbol;
-mpc_parser_t *Sexpr;
-mpc_parser_t *Qexpr;
-mpc_parser_t *Expr;
-mpc_parser_t *Program;
+/* PARSER, see read.c */
+extern mpc_parser_t *Float;
+extern mpc_parser_t *Number;
+extern mpc_parser_t *String;
+extern mpc_parser_t *Comment;
+extern mpc_parser_t *Symbol;
+extern mpc_parser_t *Sexpr;
+extern mpc_parser_t *Qexpr;
+extern mpc_parser_t *Vector;
+extern mpc_parser_t *Expr;
+extern mpc_parser_t *Program;
+
+void
+lread_init(void);
+void
+lread_cleanup(void);
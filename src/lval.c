@@ -5,6 +5,8 @@
  *
  */
 
+#include <math.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -22,8 +24,9 @@
 lval *
 lval_err(char *fmt, ...)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(error_msg));
     v->type = LVAL_ERR;
+    v->refs = 1;
 
     va_list va;
     va_start(va, fmt);
@@ -38,23 +41,45 @@ lval_err(char *fmt, ...)
 }
 
 
+/*
+ * Function:  lval_num
+ * -------------------
+ *   Return *x* as a fixnum when it fits, otherwise as a boxed number.
+ */
 lval *
 lval_num(intmax_t x)
 {
-    lval *v = malloc(sizeof(lval));
+    if (x >= FIXNUM_MIN && x <= FIXNUM_MAX)
+        return (lval *)(((uintptr_t)x << 1) | 1);
+
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(number));
     v->type = LVAL_NUM;
+    v->refs = 1;
     v->number = x;
     return v;
 }
 
 
+lval *
+lval_float(double x)
+{
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(fnumber));
+    v->type = LVAL_FLOAT;
+    v->refs = 1;
+    v->fnumber = x;
+    return v;
+}
+
+
 lval *
 lval_sym(char *s)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(global_slot));
     v->type = LVAL_SYM;
-    v->symbol = malloc(strlen(s) + 1);
-    strcpy(v->symbol, s);
+    v->refs = 1;
+    v->symbol = lsym_intern(s);
+    v->slot = UINT32_MAX;
+    v->global_slot = UINT32_MAX;
     return v;
 }
 
@@ -62,8 +87,9 @@ lval_sym(char *s)
 lval *
 lval_str(char *s)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(str));
     v->type = LVAL_STR;
+    v->refs = 1;
     v->str = malloc(strlen(s) + 1);
     strcpy(v->str, s);
     return v;
@@ -73,8 +99,9 @@ lval_str(char *s)
 lval *
 lval_fun(lbuiltin func, char *doc)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(docstring));
     v->type = LVAL_FUN;
+    v->refs = 1;
     v->builtin = func;
     v->docstring = malloc(strlen(doc) + 1);
     strcpy(v->docstring, doc);
@@ -82,15 +109,66 @@ lval_fun(lbuiltin func, char *doc)
 }
 
 
+/*
+ * Function:  lval_resolve
+ * -----------------------
+ *   Point every occurrence of a formal in *body* at the position it
+ *   will be bound at in the function's environment, so looking it up
+ *   is an indexed load (see `lenv_get`). Only a hint: symbols that end
+ *   up evaluated somewhere else are found the slow way.
+ */
+static void
+lval_resolve(lval *formals, lval *body)
+{
+    switch (LVAL_TYPE(body)) {
+    case LVAL_SYM: {
+        uint32_t slot = 0;
+        for (uint64_t i = 0; i < formals->count; i++) {
+            if (formals->cell[i]->symbol == lsym_intern(":"))
+                continue;
+            if (formals->cell[i]->symbol == body->symbol) {
+                body->slot = slot;
+                break;
+            }
+            slot++;
+        }
+        break;
+    }
+
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        for (uint64_t i = 0; i < body->count; i++)
+            lval_resolve(formals, body->cell[i]);
+        break;
+
+    default:
+        break;
+    }
+}
+
+
 lval *
-lval_lambda(lval *formals, lval *body)
+lval_lambda(lenv *e, lval *formals, lval *body)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *source = lopt_body(e, formals, body);
+    lcode *code = lcode_compile(source);
+    if (!code) {
+        lval_cleanup(formals);
+        lval_cleanup(body);
+        lval_cleanup(source);
+        return lval_err("Function body nested too deeply!");
+    }
+    lval_resolve(formals, source);
+
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(code));
     v->type = LVAL_FUN;
+    v->refs = 1;
     v->builtin = NULL;
-    v->env = lenv_new();
+    v->bound = lval_qexpr();
     v->formals = formals;
     v->body = body;
+    v->source = source;
+    v->code = code;
     return v;
 }
 
@@ -98,10 +176,13 @@ lval_lambda(lval *formals, lval *body)
 lval *
 lval_sexpr(void)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(capacity));
     v->type = LVAL_SEXPR;
+    v->refs = 1;
     v->count = 0;
     v->cell = NULL;
+    v->start = 0;
+    v->capacity = 0;
     return v;
 }
 
@@ -109,48 +190,110 @@ lval_sexpr(void)
 lval *
 lval_qexpr(void)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(capacity));
     v->type = LVAL_QEXPR;
+    v->refs = 1;
     v->count = 0;
     v->cell = NULL;
+    v->start = 0;
+    v->capacity = 0;
     return v;
 }
 
 
+lval *
+lval_vec(void)
+{
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(capacity));
+    v->type = LVAL_VEC;
+    v->refs = 1;
+    v->count = 0;
+    v->cell = NULL;
+    v->start = 0;
+    v->capacity = 0;
+    return v;
+}
+
+
+/* values whose last reference is gone, see `lval_cleanup` */
+static lval **garbage;
+static uint64_t garbage_count;
+static uint64_t garbage_size;
+
+
+static void
+lval_release(lval *v)
+{
+    if (LVAL_IS_FIXNUM(v) || --v->refs > 0)
+        return;
+
+    if (garbage_count == garbage_size) {
+        garbage_size = garbage_size ? garbage_size * 2 : 256;
+        garbage = realloc(garbage, sizeof(lval *) * garbage_size);
+    }
+    garbage[garbage_count++] = v;
+}
+
+
+/*
+ * Function:  lval_cleanup
+ * -----------------------
+ *   Drop a reference to *v*, freeing it once nothing refers to it.
+ *
+ *   Children left without references are queued on `garbage` rather
+ *   than freed recursively, so freeing a list nested a million deep
+ *   takes no C stack. Calls nested through environments only work on
+ *   what they queued themselves.
+ */
 void
 lval_cleanup(lval *v)
 {
-    switch (v->type) {
-    case LVAL_NUM:
-        break;
+    if (LVAL_IS_FIXNUM(v) || --v->refs > 0)
+        return;
+
+    uint64_t base = garbage_count;
+    for (;;) {
+        switch (v->type) {
+        case LVAL_NUM:
+        case LVAL_FLOAT:
+        case LVAL_SYM: /* interned */
+            break;
 
-    case LVAL_FUN:
-        if (!v->builtin) {
-            lenv_clean_up(v->env);
-            lval_cleanup(v->formals);
-            lval_cleanup(v->body);
-        }
-        break;
+        case LVAL_FUN:
+            if (!v->builtin) {
+                lval_release(v->bound);
+                lval_release(v->formals);
+                lval_release(v->body);
+                lval_release(v->source);
+                lcode_cleanup(v->code);
+            }
+            break;
 
-    case LVAL_ERR:
-        free(v->error_msg);
-        break;
+        case LVAL_ERR:
+            free(v->error_msg);
+            break;
 
-    case LVAL_STR:
-        free(v->str);
-        break;
+        case LVAL_BIG:
+            free(v->limbs);
+            break;
 
-    case LVAL_SYM:
-        free(v->symbol);
-        break;
+        case LVAL_STR:
+            free(v->str);
+            break;
 
-    case LVAL_SEXPR:
-    case LVAL_QEXPR:
-        for (uint64_t i = 0; i < v->count; i++)
-            lval_cleanup(v->cell[i]);
-        free(v->cell);
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+        case LVAL_VEC:
+            for (uint64_t i = 0; i < v->count; i++)
+                lval_release(v->cell[i]);
+            lfree(v->cell - v->start, sizeof(lval *) * v->capacity);
+        }
+        lheap_free(LHEAP_LVAL, v, lval_size(v));
+
+        if (garbage_count == base)
+            return;
+        v = garbage[--garbage_count];
     }
-    free(v);
 }
 
 
@@ -158,11 +301,115 @@ lval_cleanup(lval *v)
 /*                                UTILITIES                                  */
 /*****************************************************************************/
 
+/*
+ * Function:  lval_size
+ * --------------------
+ *   Return the number of bytes allocated for the heap value *v*.
+ */
+size_t
+lval_size(lval *v)
+{
+    switch (v->type) {
+    case LVAL_NUM:
+        return LVAL_SIZE(number);
+    case LVAL_FLOAT:
+        return LVAL_SIZE(fnumber);
+    case LVAL_BIG:
+        return LVAL_SIZE(negative);
+    case LVAL_ERR:
+        return LVAL_SIZE(error_msg);
+    case LVAL_SYM:
+        return LVAL_SIZE(global_slot);
+    case LVAL_STR:
+        return LVAL_SIZE(str);
+    case LVAL_FUN:
+        return v->builtin ? LVAL_SIZE(docstring) : LVAL_SIZE(code);
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+    case LVAL_VEC:
+    default:
+        return LVAL_SIZE(capacity);
+    }
+}
+
+
+/*
+ * Function:  lval_copy
+ * --------------------
+ *   Return a new reference to *v*. Copies are shared and cost nothing
+ *   until somebody wants to modify one, see `lval_unshare`.
+ */
 lval *
 lval_copy(lval *v)
 {
-    lval *x = malloc(sizeof(lval));
+    if (!LVAL_IS_FIXNUM(v))
+        v->refs++;
+    return v;
+}
+
+
+/*
+ * Function:  lval_vec_copy
+ * ------------------------
+ *   Return *v* with new copies of the vectors in it, *v* included if it
+ *   is one. Vectors are changed in place, so one written in the code is
+ *   copied every time it is evaluated, even inside a q-expression.
+ *   Anything without a vector in it is shared as usual.
+ */
+lval *
+lval_vec_copy(lval *v)
+{
+    switch (LVAL_TYPE(v)) {
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+    case LVAL_VEC:
+        break;
+    default:
+        return lval_copy(v);
+    }
+
+    lval **cells = lalloc(sizeof(lval *) * v->count);
+    int copied = LVAL_TYPE(v) == LVAL_VEC;
+    for (uint64_t i = 0; i < v->count; i++) {
+        cells[i] = lval_vec_copy(v->cell[i]);
+        copied |= cells[i] != v->cell[i];
+    }
+    if (!copied) {
+        for (uint64_t i = 0; i < v->count; i++)
+            lval_cleanup(cells[i]);
+        lfree(cells, sizeof(lval *) * v->count);
+        return lval_copy(v);
+    }
+
+    lval *x = lval_vec();
+    x->type = v->type;
+    x->count = v->count;
+    x->cell = cells;
+    x->capacity = x->count;
+    return x;
+}
+
+
+/*
+ * Function:  lval_unshare
+ * -----------------------
+ *   Return a version of *v* that the caller may modify in place. If
+ *   *v* has other references, this is a shallow copy: the children of
+ *   an expression or function are shared with the original, so they
+ *   must be unshared as well before being modified.
+ *
+ *   Takes over the caller's reference to *v*.
+ */
+lval *
+lval_unshare(lval *v)
+{
+    if (LVAL_IS_FIXNUM(v) || v->refs == 1)
+        return v;
+    v->refs--;
+
+    lval *x = lheap_alloc(LHEAP_LVAL, lval_size(v));
     x->type = v->type;
+    x->refs = 1;
 
     switch (v->type) {
     case LVAL_ERR:
@@ -174,9 +421,21 @@ lval_copy(lval *v)
         x->number = v->number;
         break;
 
+    case LVAL_FLOAT:
+        x->fnumber = v->fnumber;
+        break;
+
+    case LVAL_BIG:
+        x->limbs = malloc(sizeof(uint32_t) * v->nlimbs);
+        memcpy(x->limbs, v->limbs, sizeof(uint32_t) * v->nlimbs);
+        x->nlimbs = v->nlimbs;
+        x->negative = v->negative;
+        break;
+
     case LVAL_SYM:
-        x->symbol = malloc(strlen(v->symbol) + 1);
-        strcpy(x->symbol, v->symbol);
+        x->symbol = v->symbol;
+        x->slot = v->slot;
+        x->global_slot = v->global_slot;
         break;
 
     case LVAL_STR:
@@ -191,16 +450,21 @@ lval_copy(lval *v)
             strcpy(x->docstring, v->docstring);
         } else {
             x->builtin = NULL;
-            x->env = lenv_copy(v->env);
+            x->bound = lval_copy(v->bound);
             x->formals = lval_copy(v->formals);
             x->body = lval_copy(v->body);
+            x->source = lval_copy(v->source);
+            x->code = lcode_copy(v->code);
         }
         break;
 
     case LVAL_SEXPR:
     case LVAL_QEXPR:
+    case LVAL_VEC:
         x->count = v->count;
-        x->cell = malloc(sizeof(lval *) * x->count);
+        x->cell = lalloc(sizeof(lval *) * x->count);
+        x->start = 0;
+        x->capacity = x->count;
         for (uint64_t i = 0; i < x->count; i++)
             x->cell[i] = lval_copy(v->cell[i]);
         break;
@@ -224,6 +488,10 @@ ltype_to_name(int type)
         return "Error";
     case LVAL_NUM:
         return "Number";
+    case LVAL_FLOAT:
+        return "Float";
+    case LVAL_BIG:
+        return "Bignum";
     case LVAL_SYM:
         return "Symbol";
     case LVAL_STR:
@@ -234,6 +502,8 @@ ltype_to_name(int type)
         return "S-Expression";
     case LVAL_QEXPR:
         return "Q-Expression";
+    case LVAL_VEC:
+        return "Vector";
     default:
         return "Not my type";
     }
@@ -251,28 +521,90 @@ lval_print_str(lval *v)
 }
 
 
-void
-lval_print_expr(lval *v, char open, char close)
-{
-    if (v->count) {
-        putchar(open);
-        for (uint64_t i = 0; i < v->count; i++) {
-            lval_print(v->cell[i]);
-            if (i != (v->count - 1))
-                putchar(' ');
-        }
-        putchar(close);
+/* The fewest digits that read back as *x*, and always with a point so
+ * they read back as a float at all. */
+static void
+lval_print_float(double x)
+{
+    if (isnan(x)) {
+        printf("nan");
+        return;
     }
+
+    char s[40];
+    snprintf(s, sizeof(s), "%.15g", x);
+    if (strtod(s, NULL) != x)
+        snprintf(s, sizeof(s), "%.17g", x);
+
+    char *exp = strchr(s, 'e');
+    if (isfinite(x) && !strchr(s, '.')) {
+        size_t at = exp ? (size_t)(exp - s) : strlen(s);
+        memmove(s + at + 2, s + at, strlen(s + at) + 1);
+        memcpy(s + at, ".0", 2);
+    }
+    printf("%s", s);
 }
 
 
-void
-lval_print(lval *v)
+/* Number of values printed inside *v*: cells, or formals and body. The
+ * formals of a function are printed right away, see `lval_print`. */
+static uint64_t
+lval_print_count(lval *v)
 {
-    switch (v->type) {
+    switch (LVAL_TYPE(v)) {
+    case LVAL_FUN:
+        return v->builtin ? 0 : 2;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+    case LVAL_VEC:
+        return v->count;
+    default:
+        return 0;
+    }
+}
+
+
+/* The bracket opening, if *open* is set, or closing the expression or
+ * vector *v*. Functions are closed like s-expressions. */
+static char
+lval_print_bracket(lval *v, int open)
+{
+    switch (LVAL_TYPE(v)) {
+    case LVAL_QEXPR:
+        return open ? '{' : '}';
+    case LVAL_VEC:
+        return open ? '[' : ']';
+    default:
+        return open ? '(' : ')';
+    }
+}
+
+
+static lval *
+lval_print_child(lval *v, uint64_t i)
+{
+    if (LVAL_TYPE(v) == LVAL_FUN)
+        return v->body;
+    return v->cell[i];
+}
+
+
+static void
+lval_print_atom(lval *v)
+{
+    switch (LVAL_TYPE(v)) {
     case LVAL_NUM:
-        printf("%li", v->number);
+        printf("%li", LVAL_NUMBER(v));
+        break;
+    case LVAL_FLOAT:
+        lval_print_float(v->fnumber);
         break;
+    case LVAL_BIG: {
+        char *s = lbig_to_str(v);
+        printf("%s", s);
+        free(s);
+        break;
+    }
     case LVAL_ERR:
         printf("Error: %s", v->error_msg);
         break;
@@ -283,31 +615,78 @@ lval_print(lval *v)
         lval_print_str(v);
         break;
     case LVAL_FUN:
-        if (v->builtin) {
-            printf("<builtin>: \33[34m%s\033[0m", v->docstring);
-        } else {
-            printf("(\\ ");
-            lval_print(v->formals);
-            putchar(' ');
-            lval_print(v->body);
-            putchar(')');
-        }
+        printf("<builtin>: \33[34m%s\033[0m", v->docstring);
         break;
-    case LVAL_SEXPR:
-        lval_print_expr(v, '(', ')');
+    case LVAL_VEC: /* empty, unlike empty expressions it shows */
+        printf("[]");
         break;
-    case LVAL_QEXPR:
-        lval_print_expr(v, '{', '}');
+    default: /* empty expression */
         break;
     }
 }
 
 
+/*
+ * Function:  lval_print
+ * ---------------------
+ *   Print *v*. Nested expressions are kept track of on a stack of our
+ *   own instead of the C stack.
+ */
+void
+lval_print(lval *v)
+{
+    struct {
+        lval *v;
+        uint64_t next; /* child */
+    } *open = NULL;
+    uint64_t depth = 0, size = 0;
+
+    for (;;) {
+        if (!lval_print_count(v)) {
+            lval_print_atom(v);
+        } else {
+            if (depth == size) {
+                size = size ? size * 2 : 16;
+                open = realloc(open, sizeof(*open) * size);
+            }
+            open[depth].v = v;
+            open[depth++].next = 0;
+
+            if (LVAL_TYPE(v) == LVAL_FUN) {
+                /* without those taken by partial application, and like
+                 * empty expressions no formals print nothing */
+                printf("(\\ ");
+                for (uint64_t i = v->bound->count; i < v->formals->count; i++)
+                    printf(
+                        "%s%s", i > v->bound->count ? " " : "{",
+                        v->formals->cell[i]->symbol);
+                if (v->bound->count < v->formals->count)
+                    putchar('}');
+                open[depth - 1].next = 1;
+            } else
+                putchar(lval_print_bracket(v, 1));
+        }
+
+        while (depth && open[depth - 1].next == lval_print_count(open[depth - 1].v)) {
+            depth--;
+            putchar(lval_print_bracket(open[depth].v, 0));
+        }
+        if (!depth)
+            break;
+
+        if (open[depth - 1].next)
+            putchar(' ');
+        v = lval_print_child(open[depth - 1].v, open[depth - 1].next++);
+    }
+    free(open);
+}
+
+
 void
 lval_println(lval *v)
 {
     lval_print(v);
-    if (!((v->type == LVAL_SEXPR || v->type == LVAL_SEXPR) && v->count == 0))
+    if (!(LVAL_TYPE(v) == LVAL_SEXPR && v->count == 0))
         putchar('\n');
 }
 
@@ -316,64 +695,225 @@ lval_println(lval *v)
 /*                                 OPERATIONS                                */
 /*****************************************************************************/
 
+/* Make room for *need* values on the stack of `lval_eq`. */
+static lval **
+lval_eq_reserve(lval **pending, lval **local, uint64_t *size, uint64_t need)
+{
+    if (need <= *size)
+        return pending;
+
+    uint64_t old = *size;
+    while (*size < need)
+        *size *= 2;
+    if (pending != local)
+        return realloc(pending, sizeof(lval *) * *size);
+
+    pending = malloc(sizeof(lval *) * *size);
+    memcpy(pending, local, sizeof(lval *) * old);
+    return pending;
+}
+
+
+/* Whether the number or bignum *x* and the float *y*, in either order,
+ * are the same number. Anything else isn't, bignums never equal numbers. */
+static int
+lval_num_eq(lval *x, lval *y)
+{
+    if (LVAL_TYPE(x) == LVAL_FLOAT) {
+        lval *t = x;
+        x = y;
+        y = t;
+    }
+    if (LVAL_TYPE(y) != LVAL_FLOAT)
+        return 0;
+    if (LVAL_TYPE(x) == LVAL_BIG)
+        return lbig_eq_float(x, y->fnumber);
+    if (LVAL_TYPE(x) != LVAL_NUM)
+        return 0;
+
+    /* only integral floats in range convert to an `intmax_t` exactly */
+    double f = y->fnumber;
+    return f >= -0x1p63 && f < 0x1p63 && (intmax_t)f == LVAL_NUMBER(x) &&
+           f == (double)(intmax_t)f;
+}
+
+
 /*
  * Function:  lval_equal
  * ---------------------
  *   Compare _any_ two `lval`s and return 1 if they can be considered
  *   equal, otherwise 0.
  *
+ *   Pairs still to be compared go on a stack of our own, which stays in
+ *   `local` unless the values are big.
+ *
  *   TODO: return bool?
  */
 int
 lval_eq(lval *x, lval *y)
 {
-    if (x->type != y->type)
-        return 0;
+    lval *local[64];
+    lval **pending = local;
+    uint64_t count = 0, size = sizeof(local) / sizeof(*local);
+    int eq = 1;
+
+    for (;;) {
+        if (x == y && LVAL_TYPE(x) != LVAL_FLOAT)
+            goto next; /* shared, but NaN isn't equal to itself */
+        if (LVAL_TYPE(x) != LVAL_TYPE(y)) {
+            eq = lval_num_eq(x, y);
+            if (!eq)
+                break;
+            goto next;
+        }
 
-    switch (x->type) {
-    case LVAL_NUM:
-        return (x->number == y->number);
+        switch (LVAL_TYPE(x)) {
+        case LVAL_NUM:
+            eq = (LVAL_NUMBER(x) == LVAL_NUMBER(y));
+            break;
 
-    case LVAL_ERR:
-        return (strcmp(x->error_msg, y->error_msg) == 0);
+        case LVAL_FLOAT:
+            eq = (x->fnumber == y->fnumber);
+            break;
 
-    case LVAL_SYM:
-        return (strcmp(x->symbol, y->symbol) == 0);
+        case LVAL_BIG:
+            eq = (lbig_cmp(x, y) == 0);
+            break;
 
-    case LVAL_STR:
-        return (strcmp(x->str, y->str) == 0);
+        case LVAL_ERR:
+            eq = (strcmp(x->error_msg, y->error_msg) == 0);
+            break;
 
-    case LVAL_FUN:
-        if (x->builtin || y->builtin)
-            return (x->builtin == y->builtin);
-        return (lval_eq(x->formals, y->formals) && lval_eq(x->body, y->body));
+        case LVAL_SYM:
+            eq = (x->symbol == y->symbol);
+            break;
 
-    case LVAL_QEXPR:
-    case LVAL_SEXPR:
-        if (x->count != y->count)
-            return 0;
-        for (uint64_t i = 0; i < x->count; i++)
-            if (!lval_eq(x->cell[i], y->cell[i]))
-                return 0;
-        return 1;
+        case LVAL_STR:
+            eq = (strcmp(x->str, y->str) == 0);
+            break;
+
+        case LVAL_FUN:
+            if (x->builtin || y->builtin) {
+                eq = (x->builtin == y->builtin);
+                break;
+            }
+            pending = lval_eq_reserve(pending, local, &size, count + 6);
+            pending[count++] = x->bound;
+            pending[count++] = y->bound;
+            pending[count++] = x->formals;
+            pending[count++] = y->formals;
+            pending[count++] = x->body;
+            pending[count++] = y->body;
+            break;
+
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+        case LVAL_VEC:
+            if (x->count != y->count) {
+                eq = 0;
+                break;
+            }
+            pending =
+                lval_eq_reserve(pending, local, &size, count + 2 * x->count);
+            for (uint64_t i = 0; i < x->count; i++) {
+                pending[count++] = x->cell[i];
+                pending[count++] = y->cell[i];
+            }
+            break;
+        }
+        if (!eq)
+            break;
+
+    next:
+        if (!count)
+            break;
+        y = pending[--count];
+        x = pending[--count];
+    }
+
+    if (pending != local)
+        free(pending);
+    return eq;
+}
+
+
+/*
+ * Function:  lval_contains
+ * ------------------------
+ *   Whether *y* is *x* or can be reached from it, through the cells of
+ *   expressions and vectors or the parts of lisp functions. Vectors are
+ *   changed in place, this keeps them from ending up inside themselves.
+ */
+int
+lval_contains(lval *x, lval *y)
+{
+    lval *local[64];
+    lval **pending = local;
+    uint64_t count = 0, size = sizeof(local) / sizeof(*local);
+    int found = 0;
+
+    for (;;) {
+        if (x == y) {
+            found = 1;
+            break;
+        }
+
+        switch (LVAL_TYPE(x)) {
+        case LVAL_FUN:
+            if (x->builtin)
+                break;
+            pending = lval_eq_reserve(pending, local, &size, count + 3);
+            pending[count++] = x->bound;
+            pending[count++] = x->formals;
+            pending[count++] = x->body;
+            break;
+
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+        case LVAL_VEC:
+            pending = lval_eq_reserve(pending, local, &size, count + x->count);
+            for (uint64_t i = 0; i < x->count; i++)
+                pending[count++] = x->cell[i];
+            break;
+
+        default:
+            break;
+        }
+
+        if (!count)
+            break;
+        x = pending[--count];
     }
 
-    return 0;
+    if (pending != local)
+        free(pending);
+    return found;
 }
 
 
 /*
  * Function:  lval_pop
  * -------------------
- *   Remove and return the *i*'th element in `v->cell`.
+ *   Remove and return the *i*'th element in `v->cell`. *v* must not be
+ *   shared.
  */
 lval *
 lval_pop(lval *v, uint64_t i)
 {
     lval *x = v->cell[i];
-    memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval *) * (v->count - i - 1));
     v->count--;
-    v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+
+    if (i == 0) {
+        v->cell++;
+        v->start++;
+    } else {
+        memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval *) * (v->count - i));
+    }
+
+    if (v->count == 0) {
+        v->cell -= v->start;
+        v->start = 0;
+    }
     return x;
 }
 
@@ -386,9 +926,35 @@ lval_pop(lval *v, uint64_t i)
 lval *
 lval_add(lval *v, lval *x)
 {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval *) * v->count);
-    v->cell[v->count - 1] = x;
+    return lval_push(lval_unshare(v), x);
+}
+
+
+/*
+ * Function  lval_push
+ * -------------------
+ *   Append *x* to *v* in place, whoever else refers to it.
+ */
+lval *
+lval_push(lval *v, lval *x)
+{
+    if (v->start + v->count == v->capacity) {
+        lval **base = v->cell - v->start;
+        if (v->start && v->start >= v->count) {
+            /* at least half the array is free, at the front */
+            memmove(base, v->cell, sizeof(lval *) * v->count);
+        } else {
+            uint32_t capacity = v->capacity ? v->capacity * 2 : 4;
+            base = lrealloc(
+                base, sizeof(lval *) * v->capacity,
+                sizeof(lval *) * capacity);
+            v->capacity = capacity;
+        }
+        v->cell = base;
+        v->start = 0;
+    }
+
+    v->cell[v->count++] = x;
     return v;
 }
 
@@ -401,8 +967,8 @@ lval_add(lval *v, lval *x)
 lval *
 lval_join(lval *x, lval *y)
 {
-    while (y->count)
-        x = lval_add(x, lval_pop(y, 0));
+    for (uint64_t i = 0; i < y->count; i++)
+        x = lval_add(x, lval_copy(y->cell[i]));
 
     lval_cleanup(y);
     return x;
@@ -410,60 +976,118 @@ lval_join(lval *x, lval *y)
 
 
 /*
- * Function: lval_call
- * -------------------
- *   Return the evaluation of a lisp function (`LVAL_FUN`).
- *
- *   If there are too few arguments, the function is just partially
- *   evaluated.
+ * Function:  lval_partial
+ * -----------------------
+ *   Return a function sharing the formals, body and code of *f*, with
+ *   the *count* arguments at *args* bound after those *f* already had.
  */
-lval *
-lval_call(lenv *e, lval *f, lval *a)
+static lval *
+lval_partial(lval *f, lval **args, uint64_t count)
 {
-    if (f->builtin)
-        return f->builtin(e, a);
+    lval *bound = lval_qexpr();
+    for (uint64_t i = 0; i < f->bound->count; i++)
+        bound = lval_add(bound, lval_copy(f->bound->cell[i]));
+    for (uint64_t i = 0; i < count; i++)
+        bound = lval_add(bound, lval_copy(args[i]));
+
+    lval *v = lheap_alloc(LHEAP_LVAL, LVAL_SIZE(code));
+    v->type = LVAL_FUN;
+    v->refs = 1;
+    v->builtin = NULL;
+    v->bound = bound;
+    v->formals = lval_copy(f->formals);
+    v->body = lval_copy(f->body);
+    v->source = lval_copy(f->source);
+    v->code = lcode_copy(f->code);
+    return v;
+}
+
 
-    /* partial evaluation */
-    while (a->count) {
-        if (f->formals->count == 0) {
-            lval_cleanup(a);
+/*
+ * Function:  lval_bind
+ * --------------------
+ *   Bind the arguments of earlier partial applications of the lisp
+ *   function *f*, followed by the *count* arguments at *args*, to its
+ *   formals in a new frame. Return NULL and set *frame* if every formal
+ *   got an argument, otherwise return an error or, if there were too
+ *   few arguments, a new, partially applied function. The arguments
+ *   are left to the caller.
+ */
+lval *
+lval_bind(lval *f, lval **args, uint64_t count, lenv **frame)
+{
+    static char *rest_sym;
+    if (!rest_sym)
+        rest_sym = lsym_intern(":");
+
+    lval **bound = f->bound->cell;
+    uint64_t nbound = f->bound->count;
+    uint64_t total = nbound + count;
+    lenv *n = lenv_new();
+    uint64_t i = 0; /* next formal */
+
+    for (uint64_t j = 0; j < total; j++) {
+        if (i == f->formals->count) {
+            lenv_clean_up(n);
             return lval_err("explicit error msg");
         }
 
-        lval *sym = lval_pop(f->formals, 0);
+        lval *sym = f->formals->cell[i++];
 
-        if (strcmp(sym->symbol, ":") == 0) {
-            if (f->formals->count != 1) {
-                lval_cleanup(a);
+        if (sym->symbol == rest_sym) {
+            if (f->formals->count - i != 1) {
+                lenv_clean_up(n);
                 return lval_err(
                     "Invalid function format. ':' should be"
                     " followed by a single symbol.");
             }
 
             /* bind next formal to remaining arguments */
-            lval *nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_cleanup(sym);
-            lval_cleanup(nsym);
+            lval *rest = lval_qexpr();
+            for (; j < total; j++)
+                rest = lval_add(
+                    rest, lval_copy(j < nbound ? bound[j] : args[j - nbound]));
+            lenv_put(n, f->formals->cell[i++], rest);
+            lval_cleanup(rest);
             break;
         }
 
-        lval *val = lval_pop(a, 0);
-
-        lenv_put(f->env, sym, val);
+        lenv_put(n, sym, j < nbound ? bound[j] : args[j - nbound]);
+    }
 
-        lval_cleanup(sym);
-        lval_cleanup(val);
+    if (i < f->formals->count) {
+        lenv_clean_up(n);
+        return lval_partial(f, args, count);
     }
 
-    lval_cleanup(a); /* arg list has been bound */
+    *frame = n;
+    return NULL;
+}
 
-    if (f->formals->count == 0) {
-        f->env->parent = e;
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
-    }
 
-    return lval_copy(f);
+/*
+ * Function: lval_call
+ * -------------------
+ *   Return the evaluation of a lisp function (`LVAL_FUN`).
+ *
+ *   Functions are never modified: arguments are bound in a new frame,
+ *   see `lval_bind`.
+ */
+lval *
+lval_call(lenv *e, lval *f, lval *a)
+{
+    if (f->builtin)
+        return f->builtin(e, a);
+
+    lenv *frame;
+    lval *x = lval_bind(f, a->cell, a->count, &frame);
+    lval_cleanup(a);
+    if (x)
+        return x;
+
+    frame->parent = e;
+    frame->root = e->root;
+    return lvm_run(frame, e, lval_copy(f), lcode_copy(f->code));
 }
 
 
@@ -475,7 +1099,7 @@ lval_call(lenv *e, lval *f, lval *a)
 lval *
 lval_take(lval *v, uint64_t i)
 {
-    lval *x = lval_pop(v, i);
+    lval *x = lval_copy(v->cell[i]);
     lval_cleanup(v);
     return x;
 }
@@ -485,49 +1109,27 @@ lval_take(lval *v, uint64_t i)
 /*                                 EVALUATION                                */
 /*****************************************************************************/
 
-lval *
-lval_eval_sexpr(lenv *e, lval *v)
-{
-    if (v->count == 0)
-        return v; /* empty expression */
-
-    for (uint64_t i = 0; i < v->count; i++)
-        v->cell[i] = lval_eval(e, v->cell[i]);
-
-    for (uint64_t i = 0; i < v->count; i++)
-        if (v->cell[i]->type == LVAL_ERR)
-            return lval_take(v, i);
-
-    if (v->count == 1)
-        return lval_take(v, 0);
-
-    lval *f = lval_pop(v, 0);
-    if (f->type != LVAL_FUN) {
-        lval_cleanup(f);
-        lval_cleanup(v);
-        return lval_err("First element is not a function!");
-    }
-
-    lval *result = lval_call(e, f, v);
-    lval_cleanup(f);
-    return result;
-}
-
-
 /*
  * Function  lval_eval
  * -------------------
- *   Evaluate a lisp value.
+ *   Evaluate a lisp value. Expressions are compiled and run by
+ *   `lvm_run`.
  */
 lval *
 lval_eval(lenv *e, lval *v)
 {
-    if (v->type == LVAL_SYM) {
+    if (LVAL_TYPE(v) == LVAL_SYM) {
         lval *x = lenv_get(e, v);
         lval_cleanup(v);
         return x;
     }
-    if (v->type == LVAL_SEXPR)
-        return lval_eval_sexpr(e, v);
-    return v;
+    if (LVAL_TYPE(v) != LVAL_SEXPR)
+        return v;
+
+    lcode *code = lcode_compile(v);
+    if (!code) {
+        lval_cleanup(v);
+        return lval_err("Expression nested too deeply!");
+    }
+    return lvm_run(e, e, v, code);
 }
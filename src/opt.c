@@ -0,0 +1,384 @@
+/*
+ * opt.c
+ * -----
+ *
+ *   Rewrites the body of a lisp function before it is compiled, when
+ *   turned on with `-O` on the command line:
+ *
+ *   - arithmetic and comparisons of number literals are folded, and so
+ *     is `if` on a literal condition,
+ *   - calls of small global functions that only pass their arguments on,
+ *     like `fst` or `comp`, are replaced by their bodies,
+ *   - `eval (join (list f) {a b})` becomes `f a b`.
+ *
+ *   Builtins and functions are looked up when the body is defined, so
+ *   the rewrites assume those names aren't bound to anything else later.
+ *   Scope being dynamic, an inlined function's parameters also stop
+ *   being visible to whatever it `eval`s.
+ *
+ *   The body itself is kept as written, for printing and comparing.
+ *
+ */
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lithp.h"
+
+
+#define LOPT_MAX_NESTING 1000 /* deeper expressions are left alone */
+#define LOPT_MAX_INLINE 8     /* calls expanded inside each other */
+#define LOPT_WRAPPER_SIZE 32  /* most values in a function to inline */
+
+
+typedef struct {
+    lenv *env;
+    lval *formals; /* of the function being defined, they hide globals */
+    uint32_t nesting;
+    uint32_t inlined;
+} lopt;
+
+
+static int enabled;
+
+
+void
+lopt_enable(int on)
+{
+    enabled = on;
+}
+
+
+/* The value of the symbol *x* if the global environment is the only one
+ * binding it, or NULL. */
+static lval *
+global(lopt *o, lval *x)
+{
+    if (LVAL_TYPE(x) != LVAL_SYM || LSYM(x->symbol)->bindings != 1)
+        return NULL;
+    for (uint64_t i = 0; i < o->formals->count; i++)
+        if (o->formals->cell[i]->symbol == x->symbol)
+            return NULL;
+
+    int64_t i = lenv_find(o->env->root, x->symbol);
+    return i < 0 ? NULL : o->env->root->vals[i];
+}
+
+
+static int
+is_builtin(lval *f, lbuiltin builtin)
+{
+    return f && LVAL_TYPE(f) == LVAL_FUN && f->builtin == builtin;
+}
+
+
+static int
+is_foldable(lval *f)
+{
+    static const lbuiltin folded[] = {
+        builtin_add, builtin_sub, builtin_mul, builtin_div,
+        builtin_eq,  builtin_ne,  builtin_gt,  builtin_lt,
+        builtin_ge,  builtin_le,
+    };
+
+    for (size_t i = 0; i < sizeof(folded) / sizeof(*folded); i++)
+        if (is_builtin(f, folded[i]))
+            return 1;
+    return 0;
+}
+
+
+/* *v* as the cells of a body or `if` branch that evaluate to it. */
+static lval *
+as_code_list(lval *v)
+{
+    if (LVAL_TYPE(v) == LVAL_SEXPR) {
+        v = lval_unshare(v);
+        v->type = LVAL_QEXPR;
+        return v;
+    }
+    return lval_add(lval_qexpr(), v);
+}
+
+
+static lval *
+opt_call(lopt *, lval *);
+
+
+static lval *
+opt(lopt *o, lval *x)
+{
+    if (LVAL_TYPE(x) != LVAL_SEXPR || o->nesting >= LOPT_MAX_NESTING)
+        return lval_copy(x);
+
+    o->nesting++;
+    lval *y = opt_call(o, x);
+    o->nesting--;
+    return y;
+}
+
+
+static lval *
+opt_branch(lopt *o, lval *x)
+{
+    if (o->nesting >= LOPT_MAX_NESTING)
+        return lval_copy(x);
+
+    o->nesting++;
+    lval *y = as_code_list(opt_call(o, x));
+    o->nesting--;
+    return y;
+}
+
+
+static lval *
+opt_if(lopt *o, lval *x)
+{
+    lval *cond = opt(o, x->cell[1]);
+    lval *then = opt_branch(o, x->cell[2]);
+    lval *otherwise = opt_branch(o, x->cell[3]);
+
+    if (LVAL_TYPE(cond) == LVAL_NUM) {
+        lval *taken = LVAL_NUMBER(cond) ? then : otherwise;
+        lval_cleanup(LVAL_NUMBER(cond) ? otherwise : then);
+        lval_cleanup(cond);
+        taken = lval_unshare(taken);
+        taken->type = LVAL_SEXPR;
+        return taken;
+    }
+
+    lval *y = lval_add(lval_sexpr(), lval_copy(x->cell[0]));
+    y = lval_add(y, cond);
+    y = lval_add(y, then);
+    return lval_add(y, otherwise);
+}
+
+
+static int
+is_number(lval *x)
+{
+    return LVAL_TYPE(x) == LVAL_NUM || LVAL_TYPE(x) == LVAL_FLOAT ||
+           LVAL_TYPE(x) == LVAL_BIG;
+}
+
+
+/* The call *y* to the arithmetic or comparison builtin *f*, done now if
+ * all arguments are numbers and it doesn't fail. */
+static lval *
+fold(lopt *o, lval *f, lval *y)
+{
+    for (uint64_t i = 1; i < y->count; i++)
+        if (!is_number(y->cell[i]))
+            return y;
+
+    lval *args = lval_sexpr();
+    for (uint64_t i = 1; i < y->count; i++)
+        args = lval_add(args, lval_copy(y->cell[i]));
+
+    lval *r = f->builtin(o->env, args);
+    if (!is_number(r)) {
+        lval_cleanup(r);
+        return y;
+    }
+    lval_cleanup(y);
+    return r;
+}
+
+
+/* `(eval {a b})` is `(a b)`, and `(eval (join (list f) {a b}))` is
+ * `(f a b)`. */
+static lval *
+opt_eval(lopt *o, lval *y)
+{
+    lval *arg = y->cell[1];
+    lval *call = NULL;
+
+    if (LVAL_TYPE(arg) == LVAL_QEXPR) {
+        call = lval_copy(arg);
+    } else if (
+        LVAL_TYPE(arg) == LVAL_SEXPR && arg->count == 3 &&
+        is_builtin(global(o, arg->cell[0]), builtin_join) &&
+        LVAL_TYPE(arg->cell[1]) == LVAL_SEXPR && arg->cell[1]->count == 2 &&
+        is_builtin(global(o, arg->cell[1]->cell[0]), builtin_list) &&
+        LVAL_TYPE(arg->cell[2]) == LVAL_QEXPR) {
+        call = lval_add(lval_sexpr(), lval_copy(arg->cell[1]->cell[1]));
+        call = lval_join(call, lval_copy(arg->cell[2]));
+    }
+
+    if (!call)
+        return y;
+    call = lval_unshare(call);
+    call->type = LVAL_SEXPR;
+    lval_cleanup(y);
+
+    lval *r = opt(o, call);
+    lval_cleanup(call);
+    return r;
+}
+
+
+/*
+ * Function:  scan
+ * ---------------
+ *   Walk the body *x* of a function in the order it is evaluated. Each
+ *   formal has to come up exactly once and in order; *early* is set if a
+ *   call inside finishes before the last one did. Return 0 if *x* can't
+ *   be inlined, which includes code quoted for `if` or `eval`.
+ */
+static int
+scan(lval *x, lval *formals, uint64_t *next, int *early, uint64_t *size)
+{
+    if (++*size > LOPT_WRAPPER_SIZE)
+        return 0;
+
+    switch (LVAL_TYPE(x)) {
+    case LVAL_QEXPR:
+        return 0;
+
+    case LVAL_SYM:
+        for (uint64_t i = 0; i < formals->count; i++)
+            if (formals->cell[i]->symbol == x->symbol) {
+                if (i != *next)
+                    return 0;
+                ++*next;
+            }
+        return 1;
+
+    case LVAL_SEXPR:
+        for (uint64_t i = 0; i < x->count; i++)
+            if (!scan(x->cell[i], formals, next, early, size))
+                return 0;
+        if (*next < formals->count)
+            *early = 1;
+        return 1;
+
+    default:
+        return 1;
+    }
+}
+
+
+/* Whether the call *y* of the lisp function *f* can be replaced by its
+ * body without changing what is evaluated when. */
+static int
+is_inlinable(lval *f, lval *y)
+{
+    lval *formals = f->formals;
+    if (f->bound->count || formals->count == 0 ||
+        formals->count != y->count - 1)
+        return 0;
+    for (uint64_t i = 0; i < formals->count; i++)
+        if (formals->cell[i]->symbol == lsym_intern(":"))
+            return 0;
+
+    uint64_t next = 0, size = 0;
+    int early = 0;
+    for (uint64_t i = 0; i < f->source->count; i++)
+        if (!scan(f->source->cell[i], formals, &next, &early, &size))
+            return 0;
+    if (next != formals->count)
+        return 0;
+
+    /* arguments evaluated later than they were must not do anything */
+    if (early)
+        for (uint64_t i = 1; i < y->count; i++)
+            if (LVAL_TYPE(y->cell[i]) == LVAL_SEXPR)
+                return 0;
+    return 1;
+}
+
+
+/* *x* with the formals of a function replaced by *args*. */
+static lval *
+subst(lval *x, lval *formals, lval **args)
+{
+    switch (LVAL_TYPE(x)) {
+    case LVAL_SYM:
+        for (uint64_t i = 0; i < formals->count; i++)
+            if (formals->cell[i]->symbol == x->symbol)
+                return lval_copy(args[i]);
+        return lval_sym(x->symbol); /* gets slot hints of its own */
+
+    case LVAL_SEXPR: {
+        lval *y = lval_sexpr();
+        for (uint64_t i = 0; i < x->count; i++)
+            y = lval_add(y, subst(x->cell[i], formals, args));
+        return y;
+    }
+
+    default:
+        return lval_copy(x);
+    }
+}
+
+
+static lval *
+expand(lopt *o, lval *f, lval *y)
+{
+    if (o->inlined >= LOPT_MAX_INLINE || !is_inlinable(f, y))
+        return y;
+
+    lval *call = lval_sexpr();
+    for (uint64_t i = 0; i < f->source->count; i++)
+        call = lval_add(
+            call, subst(f->source->cell[i], f->formals, y->cell + 1));
+    lval_cleanup(y);
+
+    o->inlined++;
+    lval *r = opt(o, call);
+    o->inlined--;
+    lval_cleanup(call);
+    return r;
+}
+
+
+/*
+ * Function:  opt_call
+ * -------------------
+ *   Return what to evaluate instead of the cells of *x* evaluated as an
+ *   s-expression, whatever its type.
+ */
+static lval *
+opt_call(lopt *o, lval *x)
+{
+    if (x->count == 0)
+        return lval_sexpr();
+    if (x->count == 1)
+        return opt(o, x->cell[0]);
+
+    lval *f = global(o, x->cell[0]);
+    if (x->count == 4 && is_builtin(f, builtin_if) &&
+        LVAL_TYPE(x->cell[2]) == LVAL_QEXPR &&
+        LVAL_TYPE(x->cell[3]) == LVAL_QEXPR)
+        return opt_if(o, x);
+
+    lval *y = lval_sexpr();
+    for (uint64_t i = 0; i < x->count; i++)
+        y = lval_add(y, opt(o, x->cell[i]));
+
+    if (is_foldable(f))
+        return fold(o, f, y);
+    if (is_builtin(f, builtin_eval) && y->count == 2)
+        return opt_eval(o, y);
+    if (f && LVAL_TYPE(f) == LVAL_FUN && !f->builtin)
+        return expand(o, f, y);
+    return y;
+}
+
+
+/*
+ * Function:  lopt_body
+ * --------------------
+ *   Return what to compile for the lisp function with *formals* and
+ *   *body*, defined in *e*: *body* itself, or a rewritten copy.
+ */
+lval *
+lopt_body(lenv *e, lval *formals, lval *body)
+{
+    if (!enabled)
+        return lval_copy(body);
+
+    lopt o = {.env = e, .formals = formals};
+    return as_code_list(opt_call(&o, body));
+}
@@ -0,0 +1,156 @@
+/*
+ * read.c
+ * ------
+ *
+ *   The grammar of lithp and turning what it parses into lisp values.
+ *
+ */
+
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpc.h"
+
+#include "lithp.h"
+
+
+mpc_parser_t *Float;
+mpc_parser_t *Number;
+mpc_parser_t *String;
+mpc_parser_t *Comment;
+mpc_parser_t *Symbol;
+mpc_parser_t *Sexpr;
+mpc_parser_t *Qexpr;
+mpc_parser_t *Vector;
+mpc_parser_t *Expr;
+mpc_parser_t *Program;
+
+
+void
+lread_init(void)
+{
+    Float = mpc_new("float");
+    Number = mpc_new("number");
+    String = mpc_new("string");
+    Comment = mpc_new("comment");
+    Symbol = mpc_new("symbol");
+    Sexpr = mpc_new("sexpr");
+    Qexpr = mpc_new("qexpr");
+    Vector = mpc_new("vector");
+    Expr = mpc_new("expr");
+    Program = mpc_new("program");
+
+    mpca_lang(
+        MPCA_LANG_DEFAULT, "\
+            float    : /-?[0-9]+\\.[0-9]+([eE][-+]?[0-9]+)?/ ;\
+            number   : /-?[0-9]+/ ;\
+            string   : /'(\\\\.|[^'])*'/ ;\
+            comment  : /;[^\\r\\n]*/ ;\
+            symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!:,&]+/ ;\
+            sexpr    : '(' <expr>* ')' ;\
+            qexpr    : '{' <expr>* '}' ;\
+            vector   : '[' <expr>* ']' ;\
+            expr     : <float> | <number> | <string> | <comment> \
+                     | <symbol> | <sexpr> | <qexpr> | <vector> ;\
+            program  : /^/ <expr>* /$/ ;\
+        ",
+        Float, Number, String, Comment, Symbol, Sexpr, Qexpr, Vector, Expr,
+        Program);
+}
+
+
+void
+lread_cleanup(void)
+{
+    mpc_cleanup(
+        10, Float, Number, String, Comment, Symbol, Sexpr, Qexpr, Vector, Expr,
+        Program);
+}
+
+
+lval *
+lval_read_num(mpc_ast_t *node)
+{
+    errno = 0;
+    long x = strtol(node->contents, NULL, 10);
+    if (errno == ERANGE)
+        return lbig_read(node->contents);
+    return lval_num(x);
+}
+
+
+lval *
+lval_read_float(mpc_ast_t *node)
+{
+    errno = 0;
+    double x = strtod(node->contents, NULL);
+    /* underflow rounds to 0 or a subnormal, which is fine */
+    if (errno == ERANGE && (x == HUGE_VAL || x == -HUGE_VAL))
+        return lval_err("Invalid number");
+    return lval_float(x);
+}
+
+
+lval *
+lval_read_str(mpc_ast_t *node)
+{
+    /* unescape and remove quotation chars */
+    node->contents[strlen(node->contents) - 1] = '\0';
+    char *unescaped = malloc(strlen(node->contents + 1) + 1);
+    strcpy(unescaped, node->contents + 1);
+    unescaped = mpcf_unescape(unescaped);
+
+    lval *str = lval_str(unescaped);
+    free(unescaped);
+    return str;
+}
+
+
+lval *
+lval_read(mpc_ast_t *node)
+{
+    if (strstr(node->tag, "float"))
+        return lval_read_float(node);
+    if (strstr(node->tag, "number"))
+        return lval_read_num(node);
+    if (strstr(node->tag, "string"))
+        return lval_read_str(node);
+    if (strstr(node->tag, "symbol"))
+        return lval_sym(node->contents);
+
+    lval *x = NULL;
+    if (strcmp(node->tag, ">") == 0)
+        x = lval_sexpr();
+    if (strstr(node->tag, "sexpr"))
+        x = lval_sexpr();
+    if (strstr(node->tag, "qexpr"))
+        x = lval_qexpr();
+    if (strstr(node->tag, "vector"))
+        x = lval_vec();
+
+    for (int i = 0; i < node->children_num; i++) {
+        if (strcmp(node->children[i]->contents, "(") == 0)
+            continue;
+        if (strcmp(node->children[i]->contents, ")") == 0)
+            continue;
+        if (strcmp(node->children[i]->contents, "}") == 0)
+            continue;
+        if (strcmp(node->children[i]->contents, "{") == 0)
+            continue;
+        if (strcmp(node->children[i]->contents, "[") == 0)
+            continue;
+        if (strcmp(node->children[i]->contents, "]") == 0)
+            continue;
+        if (strcmp(node->children[i]->tag, "regex") == 0)
+            continue;
+        if (strstr(node->children[i]->tag, "comment"))
+            continue;
+        x = lval_add(x, lval_read(node->children[i]));
+    }
+
+    return x;
+}
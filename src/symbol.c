@@ -0,0 +1,88 @@
+/*
+ * symbol.c
+ * --------
+ *
+ *   The symbol table. Every symbol name is stored exactly once, so two
+ *   symbols are the same if and only if their `symbol` pointers are
+ *   equal, and environments never need to compare strings.
+ *
+ *   Interned names live until the program exits.
+ *
+ */
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lithp.h"
+
+
+static char **table; /* open addressing, linear probing */
+static uint64_t table_count;
+static uint64_t table_size;
+
+
+/* FNV-1a */
+uint64_t
+lsym_hash(char *s)
+{
+    uint64_t h = 14695981039346656037u;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211u;
+    }
+    return h;
+}
+
+
+static void
+grow(void)
+{
+    char **old = table;
+    uint64_t old_size = table_size;
+
+    table_size = table_size ? table_size * 2 : 256;
+    table = calloc(table_size, sizeof(char *));
+    table_count = 0;
+
+    for (uint64_t i = 0; i < old_size; i++) {
+        if (!old[i])
+            continue;
+        uint64_t j = lsym_hash(old[i]) & (table_size - 1);
+        while (table[j])
+            j = (j + 1) & (table_size - 1);
+        table[j] = old[i];
+        table_count++;
+    }
+    free(old);
+}
+
+
+/*
+ * Function:  lsym_intern
+ * ----------------------
+ *   Return the unique copy of the name *s*, adding it to the table on
+ *   first sight. See `LSYM` for what's stored in front of it.
+ */
+char *
+lsym_intern(char *s)
+{
+    if (table_count * 2 >= table_size)
+        grow();
+
+    uint64_t i = lsym_hash(s) & (table_size - 1);
+    while (table[i]) {
+        if (strcmp(table[i], s) == 0)
+            return table[i];
+        i = (i + 1) & (table_size - 1);
+    }
+
+    lsym *sym = malloc(sizeof(lsym) + strlen(s) + 1);
+    sym->bindings = 0;
+    strcpy(sym->name, s);
+    table[i] = sym->name;
+    table_count++;
+    return table[i];
+}
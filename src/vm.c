@@ -0,0 +1,822 @@
+/*
+ * vm.c
+ * ----
+ *
+ *   Bytecode compiler and stack machine for the bodies of lisp
+ *   functions.
+ *
+ *   `lval_lambda` compiles a body once. Running it doesn't take apart a
+ *   fresh copy of the body: values are pushed on an operand stack and
+ *   calls pop their arguments off it. Top level forms and `eval` of
+ *   q-expressions built at run time are compiled when they are run.
+ *
+ *   A call that names its function gets an inline cache for the lookup,
+ *   see `lenv_get_cached`.
+ *
+ *   `(if c {a} {b})` with literal branches compiles to a conditional
+ *   jump, guarded by a check that `if` still is the builtin when the code
+ *   runs. Otherwise it is called like any other function. `def`, `=` and
+ *   `\` with literal names are special forms the same way, see
+ *   `special_form`.
+ *
+ */
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lithp.h"
+
+
+#define LVM_MAX_DEPTH 100000 /* calls, see `lvm_set_max_depth` */
+#define LVM_MAX_NESTING 10000 /* expressions, the compiler recurses */
+
+
+typedef enum {
+    OP_CONST,    /* push constant `arg` */
+    OP_VEC,      /* the same, with new vectors, see `lval_vec_copy` */
+    OP_LOAD,     /* push the value of symbol constant `arg` */
+    OP_CALLEE,   /* the same for the symbol of call site `arg` */
+    OP_SEXPR,    /* push an empty s-expression */
+    OP_CALL,     /* evaluate the top `arg` values as an s-expression */
+    OP_TAILCALL, /* the same in tail position */
+    OP_IF,       /* see `compile_if` */
+    OP_TAILIF,
+    OP_JUMP, /* to instruction `arg` */
+    OP_RETURN,
+    OP_DEF, /* special forms of `arg` values, see `run_form` */
+    OP_PUT,
+    OP_LAMBDA,
+} lop;
+
+/* An instruction is the opcode in the low byte and its argument above. */
+#define OP(w) ((w)&0xff)
+#define ARG(w) ((w) >> 8)
+#define INSTR(op, arg) ((uint32_t)(op) | (uint32_t)(arg) << 8)
+
+
+/*****************************************************************************/
+/*                                  COMPILER                                 */
+/*****************************************************************************/
+
+typedef struct {
+    lcode *code;
+    uint32_t size;  /* of `code->ops` */
+    uint32_t csize; /* of `code->consts` */
+    uint32_t isize; /* of `code->caches` */
+    uint32_t depth; /* of the stack at this point of the code */
+    uint32_t nesting;
+} lcompiler;
+
+
+static uint32_t
+emit(lcompiler *c, uint32_t w)
+{
+    lcode *code = c->code;
+    if (code->count == c->size) {
+        c->size = c->size ? c->size * 2 : 16;
+        code->ops = realloc(code->ops, sizeof(uint32_t) * c->size);
+    }
+    code->ops[code->count] = w;
+    return code->count++;
+}
+
+
+static uint32_t
+constant(lcompiler *c, lval *v)
+{
+    lcode *code = c->code;
+    if (code->nconsts == c->csize) {
+        c->csize = c->csize ? c->csize * 2 : 8;
+        code->consts = realloc(code->consts, sizeof(lval *) * c->csize);
+    }
+    code->consts[code->nconsts] = v;
+    return code->nconsts++;
+}
+
+
+static uint32_t
+call_site(lcompiler *c, lval *sym)
+{
+    lcode *code = c->code;
+    if (code->ncaches == c->isize) {
+        c->isize = c->isize ? c->isize * 2 : 4;
+        code->caches = realloc(code->caches, sizeof(lcache) * c->isize);
+    }
+    code->caches[code->ncaches] = (lcache){.sym = sym};
+    return code->ncaches++;
+}
+
+
+static void
+push(lcompiler *c, uint32_t n)
+{
+    c->depth += n;
+    if (c->depth > c->code->max_stack)
+        c->code->max_stack = c->depth;
+}
+
+
+static void
+compile(lcompiler *, lval *, int tail);
+static void
+compile_sexpr(lcompiler *, lval *, int tail);
+
+
+/* The function of a call, looked up through a cache if it's named. */
+static void
+compile_callee(lcompiler *c, lval *x)
+{
+    if (LVAL_TYPE(x) != LVAL_SYM) {
+        compile(c, x, 0);
+        return;
+    }
+    emit(c, INSTR(OP_CALLEE, call_site(c, x)));
+    push(c, 1);
+}
+
+
+static int
+is_if(lval *x)
+{
+    return x->count == 4 && LVAL_TYPE(x->cell[0]) == LVAL_SYM &&
+           x->cell[0]->symbol == lsym_intern("if") &&
+           LVAL_TYPE(x->cell[2]) == LVAL_QEXPR &&
+           LVAL_TYPE(x->cell[3]) == LVAL_QEXPR;
+}
+
+
+/*
+ * Function:  special_form
+ * -----------------------
+ *   Return the opcode running *x* as a special form, or OP_CALL. The
+ *   names given to `def` and `=` and the formals of `\` have to be
+ *   literal symbols, and checked once here; anything else is left for
+ *   the builtin to complain about.
+ */
+static lop
+special_form(lval *x)
+{
+    if (LVAL_TYPE(x->cell[0]) != LVAL_SYM ||
+        LVAL_TYPE(x->cell[1]) != LVAL_QEXPR)
+        return OP_CALL;
+    for (uint64_t i = 0; i < x->cell[1]->count; i++)
+        if (LVAL_TYPE(x->cell[1]->cell[i]) != LVAL_SYM)
+            return OP_CALL;
+
+    char *name = x->cell[0]->symbol;
+    if (name == lsym_intern("\\"))
+        return x->count == 3 && LVAL_TYPE(x->cell[2]) == LVAL_QEXPR
+                   ? OP_LAMBDA
+                   : OP_CALL;
+
+    if (x->cell[1]->count != x->count - 2)
+        return OP_CALL;
+    if (name == lsym_intern("def"))
+        return OP_DEF;
+    if (name == lsym_intern("="))
+        return OP_PUT;
+    return OP_CALL;
+}
+
+
+/*
+ * Function:  compile_if
+ * ---------------------
+ *   `(if c {a} {b})` becomes
+ *
+ *       CALLEE if; <c>; IF k; else; end; <a>; JUMP end; else: <b>; end:
+ *
+ *   If `if` turns out to be the builtin and *c* a number, IF pops both
+ *   and jumps to `else` when it is zero. Otherwise it pushes constants
+ *   *k* and *k* + 1, the branches, and calls the four values, going on
+ *   at `end` with the result.
+ */
+static void
+compile_if(lcompiler *c, lval *x, int tail)
+{
+    compile_callee(c, x->cell[0]);
+    compile(c, x->cell[1], 0);
+
+    uint32_t k = constant(c, x->cell[2]);
+    constant(c, x->cell[3]);
+    emit(c, INSTR(tail ? OP_TAILIF : OP_IF, k));
+    uint32_t to_else = emit(c, 0);
+    uint32_t to_end = emit(c, 0);
+
+    push(c, 2);
+    c->depth -= 4;
+    uint32_t depth = c->depth;
+
+    compile_sexpr(c, x->cell[2], tail);
+    uint32_t jump = tail ? 0 : emit(c, INSTR(OP_JUMP, 0));
+
+    c->code->ops[to_else] = c->code->count;
+    c->depth = depth;
+    compile_sexpr(c, x->cell[3], tail);
+
+    c->code->ops[to_end] = c->code->count;
+    if (!tail)
+        c->code->ops[jump] = INSTR(OP_JUMP, c->code->count);
+}
+
+
+/* The cells of *x* evaluated as an s-expression, whatever its type. */
+static void
+compile_sexpr(lcompiler *c, lval *x, int tail)
+{
+    if (c->nesting > LVM_MAX_NESTING)
+        return; /* given up, see `lcode_compile` */
+
+    if (x->count == 0) {
+        emit(c, INSTR(OP_SEXPR, 0));
+        push(c, 1);
+        if (tail)
+            emit(c, INSTR(OP_RETURN, 0));
+        return;
+    }
+
+    c->nesting++;
+    if (x->count == 1) {
+        compile(c, x->cell[0], tail);
+    } else if (is_if(x)) {
+        compile_if(c, x, tail);
+    } else {
+        lop form = special_form(x);
+        compile_callee(c, x->cell[0]);
+        for (uint64_t i = 1; i < x->count; i++)
+            compile(c, x->cell[i], 0);
+        if (form != OP_CALL) {
+            emit(c, INSTR(form, x->count));
+            if (tail)
+                emit(c, INSTR(OP_RETURN, 0));
+        } else {
+            emit(c, INSTR(tail ? OP_TAILCALL : OP_CALL, x->count));
+        }
+        c->depth -= x->count - 1;
+    }
+    if (c->nesting <= LVM_MAX_NESTING)
+        c->nesting--;
+}
+
+
+/* Whether *x* is or holds a vector, which `OP_VEC` has to copy. */
+static int
+has_vec(lval *x)
+{
+    switch (LVAL_TYPE(x)) {
+    case LVAL_VEC:
+        return 1;
+    case LVAL_SEXPR:
+    case LVAL_QEXPR:
+        for (uint64_t i = 0; i < x->count; i++)
+            if (has_vec(x->cell[i]))
+                return 1;
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+
+static void
+compile(lcompiler *c, lval *x, int tail)
+{
+    switch (LVAL_TYPE(x)) {
+    case LVAL_SEXPR:
+        compile_sexpr(c, x, tail);
+        return;
+    case LVAL_SYM:
+        emit(c, INSTR(OP_LOAD, constant(c, x)));
+        break;
+    default:
+        emit(c, INSTR(has_vec(x) ? OP_VEC : OP_CONST, constant(c, x)));
+        break;
+    }
+
+    push(c, 1);
+    if (tail)
+        emit(c, INSTR(OP_RETURN, 0));
+}
+
+
+/*
+ * Function:  lcode_compile
+ * ------------------------
+ *   Compile *body*, the cells of an expression or of the q-expression
+ *   body of a lisp function, as an s-expression. The code refers to
+ *   values inside *body*, which must outlive it. Return NULL if *body*
+ *   is nested too deeply.
+ */
+lcode *
+lcode_compile(lval *body)
+{
+    lcompiler c = {0};
+    c.code = calloc(1, sizeof(lcode));
+    c.code->refs = 1;
+    compile_sexpr(&c, body, 1);
+
+    if (c.nesting > LVM_MAX_NESTING) {
+        lcode_cleanup(c.code);
+        return NULL;
+    }
+    return c.code;
+}
+
+
+lcode *
+lcode_copy(lcode *code)
+{
+    code->refs++;
+    return code;
+}
+
+
+void
+lcode_cleanup(lcode *code)
+{
+    if (--code->refs > 0)
+        return;
+    free(code->ops);
+    free(code->consts);
+    free(code->caches);
+    ljit_free(code->jit);
+    free(code);
+}
+
+
+/*****************************************************************************/
+/*                                  MACHINE                                  */
+/*****************************************************************************/
+
+/* A function body, or an expression given to `eval`, being run. */
+typedef struct {
+    lval *owner; /* the function or expression `code` was compiled from */
+    lcode *code;
+    uint32_t *pc; /* where to go on when the callee returns */
+    lenv *env;
+    lenv *outer; /* frames from `env` up to this one belong to the call */
+    size_t base; /* of its operand stack */
+} lcall;
+
+
+/* Shared by nested runs, each one works above `stack_top` of its caller. */
+static lval **stack;
+static size_t stack_size;
+static size_t stack_top;
+
+static lcall *calls;
+static uint64_t calls_count;
+static uint64_t calls_size;
+static uint64_t max_depth = LVM_MAX_DEPTH;
+
+
+static void
+reserve(size_t size)
+{
+    if (size <= stack_size)
+        return;
+    while (stack_size < size)
+        stack_size = stack_size ? stack_size * 2 : 256;
+    stack = realloc(stack, sizeof(lval *) * stack_size);
+}
+
+
+/*
+ * Function:  lvm_set_max_depth
+ * ----------------------------
+ *   Calls nested deeper than *depth* evaluate to an error instead of
+ *   using up memory.
+ */
+void
+lvm_set_max_depth(uint64_t depth)
+{
+    max_depth = depth;
+}
+
+
+/* Begin running *code*, see `lvm_run`. NULL if that's too deep. */
+static lcall *
+enter(lenv *e, lenv *outer, lval *owner, lcode *code)
+{
+    if (calls_count == max_depth)
+        return NULL;
+    if (calls_count == calls_size) {
+        calls_size = calls_size ? calls_size * 2 : 64;
+        calls = realloc(calls, sizeof(lcall) * calls_size);
+    }
+
+    lcall *c = &calls[calls_count++];
+    c->owner = owner;
+    c->code = code;
+    c->env = e;
+    c->outer = outer;
+    c->base = stack_top;
+    reserve(c->base + code->max_stack);
+    return c;
+}
+
+
+static void
+free_frames(lenv *e, lenv *outer)
+{
+    while (e != outer) {
+        lenv *parent = e->parent;
+        lenv_clean_up(e);
+        e = parent;
+    }
+}
+
+
+static lval *
+too_deep(void)
+{
+    return lval_err("Maximum call depth of %lu exceeded!", max_depth);
+}
+
+
+/* An s-expression taking over the *n* values at *v*. */
+static lval *
+args_sexpr(lval **v, uint32_t n)
+{
+    lval *a = lval_sexpr();
+    if (n) {
+        a->cell = lalloc(sizeof(lval *) * n);
+        memcpy(a->cell, v, sizeof(lval *) * n);
+        a->count = n;
+        a->capacity = n;
+    }
+    return a;
+}
+
+
+/*
+ * Function:  args_region
+ * ----------------------
+ *   Like `args_sexpr`, but bumped out of the region if it fits, for a
+ *   builtin that can't keep it: every builtin frees its argument list
+ *   before returning, except `list`, which returns it. The region is
+ *   reset once the builtin is done.
+ */
+static lval *
+args_region(lval **v, uint32_t n, lbuiltin f)
+{
+    size_t mark = lregion_mark();
+    lval *a = f == builtin_list ? NULL : lregion_alloc(LVAL_SIZE(capacity));
+    lval **cell = a && n ? lregion_alloc(sizeof(lval *) * n) : NULL;
+    if (!a || (n && !cell)) {
+        lregion_reset(mark);
+        return args_sexpr(v, n);
+    }
+
+    a->type = LVAL_SEXPR;
+    a->refs = 1;
+    a->count = n;
+    a->cell = cell;
+    a->start = 0;
+    a->capacity = n;
+    if (n)
+        memcpy(cell, v, sizeof(lval *) * n);
+    return a;
+}
+
+
+/*
+ * Function:  run_form
+ * -------------------
+ *   Run the special form *op* on the *n* values at *v*: the function,
+ *   the literal names or formals, and the rest. The result replaces the
+ *   function. Return 0, and leave the values alone, if the function
+ *   isn't the builtin the form stands for anymore or a value is an error.
+ */
+static int
+run_form(lenv *e, uint32_t op, lval **v, uint32_t n)
+{
+    static const lbuiltin builtins[] = {
+        [OP_DEF] = builtin_def,
+        [OP_PUT] = builtin_put,
+        [OP_LAMBDA] = builtin_lambda,
+    };
+
+    if (LVAL_TYPE(v[0]) != LVAL_FUN || v[0]->builtin != builtins[op])
+        return 0;
+    for (uint32_t i = 2; i < n; i++)
+        if (LVAL_TYPE(v[i]) == LVAL_ERR)
+            return 0;
+
+    lval *x;
+    if (op == OP_LAMBDA) {
+        x = lval_lambda(e, lval_copy(v[1]), lval_copy(v[2]));
+    } else {
+        void (*put)(lenv *, lval *, lval *) =
+            op == OP_DEF ? lenv_put_global : lenv_put;
+        for (uint32_t i = 2; i < n; i++)
+            put(e, v[1]->cell[i - 2], v[i]);
+        x = lval_sexpr();
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+        lval_cleanup(v[i]);
+    v[0] = x;
+    return 1;
+}
+
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" /* labels as values */
+#define VM_SWITCH(op) goto *labels[op];
+#define VM_CASE(op) label_##op
+#define NEXT                                                                   \
+    do {                                                                       \
+        w = *pc++;                                                             \
+        goto *labels[OP(w)];                                                   \
+    } while (0)
+#else
+#define VM_SWITCH(op) switch (op)
+#define VM_CASE(op) case op
+#define NEXT goto next
+#endif
+
+
+/*
+ * Function:  lvm_run
+ * ------------------
+ *   Run *code* in the environment *e* and return the result. Takes over
+ *   the references to *owner*, which *code* was compiled from, and to
+ *   *code*, and the frames from *e* up to *outer*.
+ *
+ *   Lisp calls don't nest on the C stack: each one pushes an `lcall` and
+ *   returning pops it. Calls in tail position replace the running code
+ *   instead, and frame the way `lval_eval` used to: the caller's frame is
+ *   dropped if the new frame binds every name it does; scope is dynamic,
+ *   so otherwise the callee could still see it.
+ *
+ *   `eval` and `if` with branches that aren't literals compile their
+ *   expression on the spot and run it like a call.
+ */
+lval *
+lvm_run(lenv *e, lenv *outer, lval *owner, lcode *code)
+{
+#ifdef __GNUC__
+    static void *labels[] = {
+        [OP_CONST] = &&label_OP_CONST,
+        [OP_VEC] = &&label_OP_VEC,
+        [OP_LOAD] = &&label_OP_LOAD,
+        [OP_CALLEE] = &&label_OP_CALLEE,
+        [OP_SEXPR] = &&label_OP_SEXPR,
+        [OP_CALL] = &&label_OP_CALL,
+        [OP_TAILCALL] = &&label_OP_TAILCALL,
+        [OP_IF] = &&label_OP_IF,
+        [OP_TAILIF] = &&label_OP_TAILIF,
+        [OP_JUMP] = &&label_OP_JUMP,
+        [OP_RETURN] = &&label_OP_RETURN,
+        [OP_DEF] = &&label_OP_DEF,
+        [OP_PUT] = &&label_OP_PUT,
+        [OP_LAMBDA] = &&label_OP_LAMBDA,
+    };
+#endif
+
+    uint64_t entry = calls_count;
+    if (!enter(e, outer, owner, code)) {
+        free_frames(e, outer);
+        lval_cleanup(owner);
+        lcode_cleanup(code);
+        return too_deep();
+    }
+
+    lcall *c;
+    lval **sp = stack + stack_top;
+    uint32_t *pc = code->ops;
+
+    uint32_t w, n;
+    int in_tail;
+    lval *x;
+
+    NEXT;
+#ifndef __GNUC__
+next:
+    w = *pc++;
+#endif
+    VM_SWITCH(OP(w))
+    {
+    VM_CASE(OP_CONST) :
+        *sp++ = lval_copy(code->consts[ARG(w)]);
+        NEXT;
+
+    VM_CASE(OP_VEC) :
+        *sp++ = lval_vec_copy(code->consts[ARG(w)]);
+        NEXT;
+
+    VM_CASE(OP_LOAD) :
+        *sp++ = lenv_get(e, code->consts[ARG(w)]);
+        NEXT;
+
+    VM_CASE(OP_CALLEE) :
+        *sp++ = lenv_get_cached(e, &code->caches[ARG(w)]);
+        NEXT;
+
+    VM_CASE(OP_SEXPR) :
+        *sp++ = lval_sexpr();
+        NEXT;
+
+    VM_CASE(OP_CALL) :
+        n = ARG(w);
+        in_tail = 0;
+        goto call;
+
+    VM_CASE(OP_TAILCALL) :
+        n = ARG(w);
+        in_tail = 1;
+        goto call;
+
+    VM_CASE(OP_IF) :
+        in_tail = 0;
+        goto cond;
+
+    VM_CASE(OP_TAILIF) :
+        in_tail = 1;
+        goto cond;
+
+    VM_CASE(OP_JUMP) :
+        pc = code->ops + ARG(w);
+        NEXT;
+
+    VM_CASE(OP_RETURN) :
+        x = *--sp;
+        goto leave;
+
+    VM_CASE(OP_DEF) :
+    VM_CASE(OP_PUT) :
+    VM_CASE(OP_LAMBDA) :
+        n = ARG(w);
+        in_tail = 0;
+        if (!run_form(e, OP(w), sp - n, n))
+            goto call;
+        sp -= n - 1;
+        NEXT;
+    }
+
+cond:
+    if (LVAL_TYPE(sp[-2]) == LVAL_FUN && sp[-2]->builtin == builtin_if &&
+        LVAL_TYPE(sp[-1]) == LVAL_NUM) {
+        int taken = LVAL_NUMBER(sp[-1]) != 0;
+        lval_cleanup(sp[-1]);
+        lval_cleanup(sp[-2]);
+        sp -= 2;
+        pc = taken ? pc + 2 : code->ops + pc[0];
+        NEXT;
+    }
+    *sp++ = lval_copy(code->consts[ARG(w)]);
+    *sp++ = lval_copy(code->consts[ARG(w) + 1]);
+    pc = code->ops + pc[1]; /* past both branches, unused in tail position */
+    n = 4;
+    /* FALLTHRU */
+
+call:
+    sp -= n;
+    stack_top = sp - stack;
+
+    for (uint32_t i = 0; i < n; i++)
+        if (LVAL_TYPE(sp[i]) == LVAL_ERR) {
+            x = lval_copy(sp[i]);
+            for (uint32_t j = 0; j < n; j++)
+                lval_cleanup(sp[j]);
+            goto result;
+        }
+
+    lval *g = sp[0];
+    if (LVAL_TYPE(g) != LVAL_FUN) {
+        for (uint32_t j = 0; j < n; j++)
+            lval_cleanup(sp[j]);
+        x = lval_err("First element is not a function!");
+        goto result;
+    }
+
+    lval *next_owner;
+    lcode *next_code;
+    lenv *next_env;
+
+    size_t mark = lregion_mark();
+    if (g->builtin == builtin_if || g->builtin == builtin_eval) {
+        lval *a = args_region(sp + 1, n - 1, g->builtin);
+        x = g->builtin == builtin_if ? builtin_if_tail(a)
+                                     : builtin_eval_tail(a);
+        lregion_reset(mark);
+        lval_cleanup(g);
+        if (LVAL_TYPE(x) == LVAL_ERR)
+            goto result;
+
+        next_code = lcode_compile(x);
+        if (!next_code) {
+            lval_cleanup(x);
+            x = lval_err("Expression nested too deeply!");
+            goto result;
+        }
+        next_owner = x;
+        next_env = e;
+    } else if (g->builtin) {
+        lval *a = args_region(sp + 1, n - 1, g->builtin);
+        gc_inhibit++;
+        x = g->builtin(e, a);
+        gc_inhibit--;
+        lregion_reset(mark);
+        lval_cleanup(g);
+        goto result;
+    } else {
+        /* checking compiled code runs the interpreter above the values */
+        stack_top += n;
+        x = ljit_call(e, g, sp + 1, n - 1);
+        stack_top -= n;
+        sp = stack + stack_top;
+        if (x) {
+            for (uint32_t j = 0; j < n; j++)
+                lval_cleanup(sp[j]);
+            goto result;
+        }
+
+        x = lval_bind(g, sp + 1, n - 1, &next_env);
+        for (uint32_t j = 1; j < n; j++)
+            lval_cleanup(sp[j]);
+        if (x) {
+            lval_cleanup(g);
+            goto result;
+        }
+        next_owner = g;
+        next_code = lcode_copy(g->code);
+    }
+
+    c = &calls[calls_count - 1];
+    if (in_tail) {
+        if (next_env != e) {
+            if (e != c->outer && lenv_shadows(next_env, e)) {
+                lenv *parent = e->parent;
+                lenv_clean_up(e);
+                e = parent;
+            }
+            next_env->parent = e;
+            next_env->root = e->root;
+            e = next_env;
+        }
+
+        lval_cleanup(c->owner);
+        lcode_cleanup(c->code);
+        c->owner = next_owner;
+        c->code = code = next_code;
+        reserve(c->base + code->max_stack);
+        sp = stack + c->base;
+        pc = code->ops;
+        NEXT;
+    }
+
+    if (next_env != e) {
+        next_env->parent = e;
+        next_env->root = e->root;
+    }
+    c->pc = pc;
+    c->env = e;
+    c = enter(next_env, e, next_owner, next_code);
+    if (!c) {
+        free_frames(next_env, e);
+        lval_cleanup(next_owner);
+        lcode_cleanup(next_code);
+        x = too_deep();
+        goto result;
+    }
+    e = next_env;
+    code = next_code;
+    sp = stack + c->base;
+    pc = code->ops;
+    NEXT;
+
+result:
+    if (in_tail)
+        goto leave;
+    sp = stack + stack_top; /* the stack may have moved */
+    *sp++ = x;
+    NEXT;
+
+leave:
+    c = &calls[--calls_count];
+    free_frames(e, c->outer);
+    lval_cleanup(c->owner);
+    lcode_cleanup(c->code);
+    stack_top = c->base;
+    if (calls_count == entry)
+        return x;
+
+    c--;
+    code = c->code;
+    pc = c->pc;
+    e = c->env;
+    sp = stack + stack_top;
+    *sp++ = x;
+    NEXT;
+}
+
+
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif